@@ -0,0 +1,247 @@
+#include <new>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define BOX_NARROWPHASE_SSE
+#endif
+#include "box_narrowphase.hpp"
+#include "profiler.hpp"
+
+using std::size;
+using std::fabs;
+
+namespace physics {
+
+// four lane float vector and lane mask (SSE or scalar fallback)
+#ifdef BOX_NARROWPHASE_SSE
+struct float4
+{
+	__m128 v;
+};
+
+struct mask4
+{
+	__m128 v;
+};
+
+static float4 load(float const * p) {return float4{_mm_load_ps(p)};}
+static float4 splat(float x) {return float4{_mm_set1_ps(x)};}
+static float4 operator+(float4 a, float4 b) {return float4{_mm_add_ps(a.v, b.v)};}
+static float4 operator-(float4 a, float4 b) {return float4{_mm_sub_ps(a.v, b.v)};}
+static float4 operator*(float4 a, float4 b) {return float4{_mm_mul_ps(a.v, b.v)};}
+static float4 abs(float4 a) {return float4{_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)};}
+static mask4 greater(float4 a, float4 b) {return mask4{_mm_cmpgt_ps(a.v, b.v)};}
+static mask4 operator|(mask4 a, mask4 b) {return mask4{_mm_or_ps(a.v, b.v)};}
+static mask4 no_lanes() {return mask4{_mm_setzero_ps()};}
+static int bits(mask4 m) {return _mm_movemask_ps(m.v);}
+#else
+struct float4
+{
+	float v[4];
+};
+
+struct mask4
+{
+	bool v[4];
+};
+
+template <typename F>
+static float4 per_lane(F && f)
+{
+	float4 r;
+	for (int i = 0; i < 4; ++i)
+		r.v[i] = f(i);
+	return r;
+}
+
+static float4 load(float const * p) {return per_lane([p](int i){return p[i];});}
+static float4 splat(float x) {return per_lane([x](int){return x;});}
+static float4 operator+(float4 a, float4 b) {return per_lane([&](int i){return a.v[i] + b.v[i];});}
+static float4 operator-(float4 a, float4 b) {return per_lane([&](int i){return a.v[i] - b.v[i];});}
+static float4 operator*(float4 a, float4 b) {return per_lane([&](int i){return a.v[i] * b.v[i];});}
+static float4 abs(float4 a) {return per_lane([&](int i){return fabs(a.v[i]);});}
+static mask4 greater(float4 a, float4 b) {return mask4{{a.v[0] > b.v[0], a.v[1] > b.v[1], a.v[2] > b.v[2], a.v[3] > b.v[3]}};}
+static mask4 operator|(mask4 a, mask4 b) {return mask4{{a.v[0] || b.v[0], a.v[1] || b.v[1], a.v[2] || b.v[2], a.v[3] || b.v[3]}};}
+static mask4 no_lanes() {return mask4{{false, false, false, false}};}
+static int bits(mask4 m) {return m.v[0] | (m.v[1] << 1) | (m.v[2] << 2) | (m.v[3] << 3);}
+#endif
+
+/*! OBB separating axis test (see Ericson, Real-Time Collision Detection 4.4.1) in A space for four
+box pairs, \return lane bits of separated pairs */
+template <typename Block>
+static int separated(Block const & b)
+{
+	float4 const eps = splat(1e-6f),  // cross product of parallel edges is near zero
+		tol = splat(box_pair_culler::tolerance);
+
+	// B rotation and B origin in A space
+	float4 R[3][3], AbsR[3][3], t[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			R[i][j] = load(b.basis_a[0*3+i]) * load(b.basis_b[0*3+j])
+				+ load(b.basis_a[1*3+i]) * load(b.basis_b[1*3+j])
+				+ load(b.basis_a[2*3+i]) * load(b.basis_b[2*3+j]);
+			AbsR[i][j] = abs(R[i][j]) + eps;
+		}
+
+		t[i] = load(b.basis_a[0*3+i]) * load(b.delta[0])
+			+ load(b.basis_a[1*3+i]) * load(b.delta[1])
+			+ load(b.basis_a[2*3+i]) * load(b.delta[2]);
+	}
+
+	float4 const a[3] = {load(b.extents_a[0]), load(b.extents_a[1]), load(b.extents_a[2])},
+		e[3] = {load(b.extents_b[0]), load(b.extents_b[1]), load(b.extents_b[2])};
+
+	mask4 result = no_lanes();
+
+	// A axes
+	for (int i = 0; i < 3; ++i)
+	{
+		float4 const rb = e[0]*AbsR[i][0] + e[1]*AbsR[i][1] + e[2]*AbsR[i][2];
+		result = result | greater(abs(t[i]), a[i] + rb + tol);
+	}
+
+	// B axes
+	for (int j = 0; j < 3; ++j)
+	{
+		float4 const ra = a[0]*AbsR[0][j] + a[1]*AbsR[1][j] + a[2]*AbsR[2][j],
+			dist = abs(t[0]*R[0][j] + t[1]*R[1][j] + t[2]*R[2][j]);
+		result = result | greater(dist, ra + e[j] + tol);
+	}
+
+	// A[i] x B[j] axes
+	for (int i = 0; i < 3; ++i)
+	{
+		int const i1 = (i+1) % 3,
+			i2 = (i+2) % 3;
+
+		for (int j = 0; j < 3; ++j)
+		{
+			int const j1 = (j+1) % 3,
+				j2 = (j+2) % 3;
+
+			float4 const ra = a[i1]*AbsR[i2][j] + a[i2]*AbsR[i1][j],
+				rb = e[j1]*AbsR[i][j2] + e[j2]*AbsR[i][j1],
+				dist = abs(t[i2]*R[i1][j] - t[i1]*R[i2][j]);
+			result = result | greater(dist, ra + rb + tol);
+		}
+	}
+
+	return bits(result);
+}
+
+static bool is_box(btCollisionObject const * o)
+{
+	return o->getCollisionShape()->getShapeType() == BOX_SHAPE_PROXYTYPE;
+}
+
+static btCollisionObject const * object(btBroadphaseProxy const * proxy)
+{
+	return static_cast<btCollisionObject const *>(proxy->m_clientObject);
+}
+
+btCollisionAlgorithm * box_box_algorithm::create_func::CreateCollisionAlgorithm(
+	btCollisionAlgorithmConstructionInfo & ci, btCollisionObjectWrapper const * a, btCollisionObjectWrapper const * b)
+{
+	void * mem = ci.m_dispatcher1->allocateCollisionAlgorithm(sizeof(box_box_algorithm));
+	return new (mem) box_box_algorithm{ci, a, b};
+}
+
+box_box_algorithm::box_box_algorithm(btCollisionAlgorithmConstructionInfo const & ci,
+	btCollisionObjectWrapper const * a, btCollisionObjectWrapper const * b)
+	: btBoxBoxCollisionAlgorithm{nullptr, ci, a, b}
+{}
+
+void box_box_algorithm::processCollision(btCollisionObjectWrapper const * a, btCollisionObjectWrapper const * b,
+	btDispatcherInfo const & info, btManifoldResult * result)
+{
+	if (!separated)  // separated pair without contacts, nothing to add or remove
+		btBoxBoxCollisionAlgorithm::processCollision(a, b, info, result);
+}
+
+void box_pair_culler::cull(btOverlappingPairCache & pairs)
+{
+	PHYSICS_PROFILE_SCOPE("box_pair_culler");
+
+	_culled_count = 0;
+	_box_pairs.clear();
+
+	btBroadphasePairArray const & pair_array = pairs.getOverlappingPairArray();
+	for (int i = 0; i < size(pair_array); ++i)
+	{
+		btBroadphasePair const & pair = pair_array[i];
+		if (pair.m_algorithm && is_box(object(pair.m_pProxy0)) && is_box(object(pair.m_pProxy1)))
+			_box_pairs.push_back(&pair);
+	}
+
+	// gather into SoA blocks, unused lanes of the last block are zero (never reported)
+	size_t const pair_count = size(_box_pairs);
+	_blocks.assign((pair_count + 3) / 4, pair_block{});
+	for (size_t idx = 0; idx < pair_count; ++idx)
+	{
+		pair_block & block = _blocks[idx / 4];
+		size_t const lane = idx % 4;
+
+		btCollisionObject const * a = object(_box_pairs[idx]->m_pProxy0),
+			* b = object(_box_pairs[idx]->m_pProxy1);
+		btTransform const & Ta = a->getWorldTransform(),
+			& Tb = b->getWorldTransform();
+
+		for (int r = 0; r < 3; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				block.basis_a[3*r + c][lane] = Ta.getBasis()[r][c];
+				block.basis_b[3*r + c][lane] = Tb.getBasis()[r][c];
+			}
+		}
+
+		btVector3 const delta = Tb.getOrigin() - Ta.getOrigin(),
+			extents_a = static_cast<btBoxShape const *>(a->getCollisionShape())->getHalfExtentsWithMargin(),
+			extents_b = static_cast<btBoxShape const *>(b->getCollisionShape())->getHalfExtentsWithMargin();
+
+		for (int k = 0; k < 3; ++k)
+		{
+			block.delta[k][lane] = delta[k];
+			block.extents_a[k][lane] = extents_a[k];
+			block.extents_b[k][lane] = extents_b[k];
+		}
+	}
+
+	for (size_t block_idx = 0; block_idx < size(_blocks); ++block_idx)
+	{
+		int const lanes = separated(_blocks[block_idx]);
+		for (size_t lane = 0; lane < 4; ++lane)
+		{
+			size_t const idx = 4*block_idx + lane;
+			if (idx >= pair_count)
+				break;
+
+			auto * algorithm = static_cast<box_box_algorithm *>(_box_pairs[idx]->m_algorithm);
+			algorithm->separated = false;
+			if (!(lanes & (1 << lane)))
+				continue;
+
+			// separated boxes still needs narrowphase to remove old contacts
+			bool has_contacts = false;
+			_manifolds.resize(0);
+			algorithm->getAllContactManifolds(_manifolds);
+			for (int i = 0; i < size(_manifolds) && !has_contacts; ++i)
+				has_contacts = _manifolds[i]->getNumContacts() > 0;
+
+			if (!has_contacts)
+			{
+				algorithm->separated = true;
+				++_culled_count;
+			}
+		}
+	}
+
+	PHYSICS_PROFILE_COUNTER("box pairs", pair_count);
+	PHYSICS_PROFILE_COUNTER("culled box pairs", _culled_count);
+}
+
+
+}  // physics
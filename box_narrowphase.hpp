@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <bullet/BulletCollision/btBulletCollisionCommon.h>
+#include <bullet/BulletCollision/CollisionDispatch/btBoxBoxCollisionAlgorithm.h>
+
+namespace physics {
+
+/*! btBoxBoxCollisionAlgorithm which skips the narrowphase of a pair found separated by box_pair_culler.
+\note algorithm is registered for box-box pairs by box_dispatcher, body shape must not be changed while
+body is in world (pair algorithm is not recreated) */
+class box_box_algorithm : public btBoxBoxCollisionAlgorithm
+{
+public:
+	struct create_func : public btCollisionAlgorithmCreateFunc
+	{
+		btCollisionAlgorithm * CreateCollisionAlgorithm(btCollisionAlgorithmConstructionInfo & ci,
+			btCollisionObjectWrapper const * a, btCollisionObjectWrapper const * b) override;
+	};
+
+	bool separated = false;  //!< set by box_pair_culler::cull() before each dispatch
+
+	box_box_algorithm(btCollisionAlgorithmConstructionInfo const & ci, btCollisionObjectWrapper const * a,
+		btCollisionObjectWrapper const * b);
+
+	void processCollision(btCollisionObjectWrapper const * a, btCollisionObjectWrapper const * b,
+		btDispatcherInfo const & info, btManifoldResult * result) override;
+};
+
+/*! Batched separating axis test for overlapping box-box pairs.
+
+Box pairs from the pair cache are gathered into SoA blocks of four pairs and all 15 OBB separating
+axes are tested at once (SSE). Separated pairs without contacts would not produce anything in
+btBoxBoxCollisionAlgorithm, so they are marked in their box_box_algorithm and the narrowphase runs
+only for touching boxes. Pairs without algorithm yet (new this step) are not tested.
+\code
+box_pair_culler culler;
+culler.cull(*broadphase.getOverlappingPairCache());
+dispatcher.dispatchAllCollisionPairs(...);  // culled pairs are skipped by box_box_algorithm
+\endcode */
+class box_pair_culler
+{
+public:
+	static constexpr btScalar tolerance = btScalar(1e-3);  //!< boxes closer than tolerance are not culled
+
+	void cull(btOverlappingPairCache & pairs);  //!< marks pair algorithms of separated box pairs
+
+	size_t box_pair_count() const {return _box_pairs.size();}  //!< box pairs tested by the last cull()
+	size_t culled_count() const {return _culled_count;}  //!< culled by the last cull()
+
+private:
+	struct alignas(16) pair_block  // four pairs, one per lane
+	{
+		float basis_a[9][4], basis_b[9][4];  // row major rotations
+		float delta[3][4];  // B origin - A origin
+		float extents_a[3][4], extents_b[3][4];
+	};
+
+	std::vector<btBroadphasePair const *> _box_pairs;
+	std::vector<pair_block> _blocks;
+	size_t _culled_count = 0;
+	btManifoldArray _manifolds;  // scratch
+};
+
+/*! Collision dispatcher which skips the narrowphase of separated box-box pairs, see box_pair_culler.
+`Dispatcher` is btCollisionDispatcher or btCollisionDispatcherMt. */
+template <typename Dispatcher>
+class box_dispatcher : public Dispatcher
+{
+public:
+	explicit box_dispatcher(btCollisionConfiguration * config)
+		: Dispatcher{config}
+	{
+		this->registerCollisionCreateFunc(BOX_SHAPE_PROXYTYPE, BOX_SHAPE_PROXYTYPE, &_box_box);
+	}
+
+	box_pair_culler const & culler() const {return _culler;}
+
+	void dispatchAllCollisionPairs(btOverlappingPairCache * pairs, btDispatcherInfo const & info,
+		btDispatcher * dispatcher) override
+	{
+		_culler.cull(*pairs);
+		Dispatcher::dispatchAllCollisionPairs(pairs, info, dispatcher);
+	}
+
+private:
+	box_box_algorithm::create_func _box_box;
+	box_pair_culler _culler;
+};
+
+}  // physics
@@ -1,7 +1,13 @@
 #pragma once
+#include <cstddef>
+#include <cstring>
 #include <OGRE/OgreVector.h>
+#include <OGRE/OgreQuaternion.h>
 #include <bullet/LinearMath/btVector3.h>
 #include <bullet/LinearMath/btQuaternion.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 inline btVector3 to_bullet(Ogre::Vector3 const & v)
 {
@@ -17,3 +23,41 @@ inline Ogre::Quaternion to_ogre(btQuaternion const & q)
 {
 	return Ogre::Quaternion{q.w(), q.x(), q.y(), q.z()};
 }
+
+// batch converters (see physics::world::export_transforms())
+
+//! converts `n` packed (x, y, z) positions to OGRE vectors
+inline void to_ogre(float const * xyz, size_t n, Ogre::Vector3 * out)
+{
+	static_assert(sizeof(Ogre::Vector3) == 3*sizeof(float), "packed float Ogre::Vector3 expected");
+	std::memcpy(static_cast<void *>(out), xyz, n * sizeof(Ogre::Vector3));  // same layout
+}
+
+//! converts `n` packed (x, y, z, w) quaternions to OGRE (w, x, y, z) quaternions
+inline void to_ogre(float const * xyzw, size_t n, Ogre::Quaternion * out)
+{
+	static_assert(sizeof(Ogre::Quaternion) == 4*sizeof(float), "packed float Ogre::Quaternion expected");
+	float * wxyz = reinterpret_cast<float *>(out);
+
+	size_t i = 0;
+
+#if defined(__SSE__)
+	for (; i + 2 <= n; i += 2)  // two quaternions per iteration
+	{
+		__m128 q0 = _mm_loadu_ps(xyzw + 4*i),
+			q1 = _mm_loadu_ps(xyzw + 4*i + 4);
+		_mm_storeu_ps(wxyz + 4*i, _mm_shuffle_ps(q0, q0, _MM_SHUFFLE(2, 1, 0, 3)));
+		_mm_storeu_ps(wxyz + 4*i + 4, _mm_shuffle_ps(q1, q1, _MM_SHUFFLE(2, 1, 0, 3)));
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		float const * q = xyzw + 4*i;
+		float * r = wxyz + 4*i;
+		r[0] = q[3];
+		r[1] = q[0];
+		r[2] = q[1];
+		r[3] = q[2];
+	}
+}
@@ -0,0 +1,337 @@
+// world checkpoint and restore implementation
+#include <fstream>
+#include <cstring>
+#include <cassert>
+#include "physics.hpp"
+
+using std::vector, std::string;
+using std::ifstream, std::ofstream, std::ios, std::streampos;
+using std::size, std::swap, std::make_pair;
+using std::move;
+using std::memcmp;
+
+namespace physics {
+
+static constexpr char magic[4] = {'P', 'H', 'C', 'K'};
+static constexpr uint32_t version = 1;
+static constexpr uint32_t no_index = ~0u;
+
+int collision_group(btCollisionObject const * o);  // physics.cpp
+
+static void store(btVector3 const & v, float * out)
+{
+	out[0] = v.x();
+	out[1] = v.y();
+	out[2] = v.z();
+}
+
+static btVector3 load_vector(float const * v)
+{
+	return btVector3{v[0], v[1], v[2]};
+}
+
+static world_checkpoint::contact_point store(btManifoldPoint const & pt)
+{
+	world_checkpoint::contact_point result;
+	store(pt.m_localPointA, result.local_a);
+	store(pt.m_localPointB, result.local_b);
+	store(pt.m_positionWorldOnA, result.world_a);
+	store(pt.m_positionWorldOnB, result.world_b);
+	store(pt.m_normalWorldOnB, result.normal);
+	result.distance = pt.m_distance1;
+	result.applied_impulse = pt.m_appliedImpulse;
+	result.lateral_impulse1 = pt.m_appliedImpulseLateral1;
+	result.lateral_impulse2 = pt.m_appliedImpulseLateral2;
+	store(pt.m_lateralFrictionDir1, result.lateral_dir1);
+	store(pt.m_lateralFrictionDir2, result.lateral_dir2);
+	result.friction = pt.m_combinedFriction;
+	result.restitution = pt.m_combinedRestitution;
+	result.lifetime = pt.m_lifeTime;
+	return result;
+}
+
+//! \param swapped manifold has bodies in the opposite order
+static btManifoldPoint load_point(world_checkpoint::contact_point const & p, bool swapped)
+{
+	btVector3 local_a = load_vector(p.local_a),
+		local_b = load_vector(p.local_b),
+		world_a = load_vector(p.world_a),
+		world_b = load_vector(p.world_b),
+		normal = load_vector(p.normal);
+
+	if (swapped)
+	{
+		swap(local_a, local_b);
+		swap(world_a, world_b);
+		normal = -normal;
+	}
+
+	btManifoldPoint pt{local_a, local_b, normal, p.distance};
+	pt.m_positionWorldOnA = world_a;
+	pt.m_positionWorldOnB = world_b;
+	pt.m_appliedImpulse = p.applied_impulse;
+	pt.m_appliedImpulseLateral1 = p.lateral_impulse1;
+	pt.m_appliedImpulseLateral2 = p.lateral_impulse2;
+	pt.m_lateralFrictionDir1 = load_vector(p.lateral_dir1);
+	pt.m_lateralFrictionDir2 = load_vector(p.lateral_dir2);
+	pt.m_combinedFriction = p.friction;
+	pt.m_combinedRestitution = p.restitution;
+	pt.m_lifeTime = p.lifetime;
+	return pt;
+}
+
+void world::checkpoint(world_checkpoint & cp)
+{
+	cp.bodies.clear();
+	cp.manifolds.clear();
+	cp.points.clear();
+
+	_checkpoint_index.assign(size(_world->getCollisionObjectArray()), no_index);
+
+	_bodies.for_each([this, &cp](body_handle h, body const & b){
+		btRigidBody const & rb = b.rigid_body();
+
+		world_checkpoint::body_state s = {};
+		s.handle = h;
+		s.user_index = rb.getUserIndex();
+
+		btCollisionShape const * shape = rb.getCollisionShape();
+		s.shape_type = shape->getShapeType();
+		if (s.shape_type == BOX_SHAPE_PROXYTYPE)
+			store(static_cast<btBoxShape const *>(shape)->getHalfExtentsWithMargin(), s.shape_dims);
+		else if (s.shape_type == SPHERE_SHAPE_PROXYTYPE)
+			s.shape_dims[0] = static_cast<btSphereShape const *>(shape)->getRadius();
+
+		s.mass = rb.getInvMass() > 0 ? 1 / rb.getInvMass() : 0;
+
+		btTransform const T = transform(h);  // particles included
+		store(T.getOrigin(), s.origin);
+		btQuaternion const q = T.getRotation();
+		s.rotation[0] = q.x();
+		s.rotation[1] = q.y();
+		s.rotation[2] = q.z();
+		s.rotation[3] = q.w();
+
+		uint32_t const particle = _particles.find(h);
+		store(particle != particle_tier::no_particle ? _particles.velocity(particle) : rb.getLinearVelocity(),
+			s.linear_velocity);
+		store(rb.getAngularVelocity(), s.angular_velocity);
+		s.activation_state = rb.getActivationState();
+		s.deactivation_time = rb.getDeactivationTime();
+		s.in_world = (rb.isInWorld() || particle != particle_tier::no_particle) ? 1 : 0;  // particles are restored into Bullet
+
+		if (rb.isInWorld())
+			_checkpoint_index[rb.getWorldArrayIndex()] = static_cast<uint32_t>(size(cp.bodies));
+
+		cp.bodies.push_back(s);
+	});
+
+	// contact cache of world owned bodies
+	for (int i = 0; i < _dispatcher->getNumManifolds(); ++i)
+	{
+		btPersistentManifold const * manifold = _dispatcher->getManifoldByIndexInternal(i);
+		if (manifold->getNumContacts() == 0)
+			continue;
+
+		uint32_t const a = _checkpoint_index[manifold->getBody0()->getWorldArrayIndex()],
+			b = _checkpoint_index[manifold->getBody1()->getWorldArrayIndex()];
+		if (a == no_index || b == no_index)
+			continue;
+
+		cp.manifolds.push_back(world_checkpoint::manifold_state{a, b, static_cast<uint32_t>(size(cp.points)),
+			static_cast<uint32_t>(manifold->getNumContacts())});
+
+		for (int j = 0; j < manifold->getNumContacts(); ++j)
+			cp.points.push_back(store(manifold->getContactPoint(j)));
+	}
+
+	cp.accumulator = _accumulator;
+}
+
+void world::restore(world_checkpoint const & cp)
+{
+	restore(cp, nullptr);
+}
+
+vector<body_handle> world::instantiate(world_checkpoint const & cp)
+{
+	vector<body_handle> handles, simulated;
+	handles.reserve(size(cp.bodies));
+
+	for (world_checkpoint::body_state const & s : cp.bodies)
+	{
+		shape_cache::shape_ref shape;
+		if (s.shape_type == BOX_SHAPE_PROXYTYPE)
+			shape = _shapes.box(load_vector(s.shape_dims));
+		else if (s.shape_type == SPHERE_SHAPE_PROXYTYPE)
+			shape = _shapes.sphere(s.shape_dims[0]);
+		else
+			assert(false && "only box and sphere shapes can be instantiated");
+
+		body_handle const h = create_body(move(shape), translate(load_vector(s.origin)), s.mass);
+		get(h).rigid_body().setUserIndex(s.user_index);
+		handles.push_back(h);
+		if (s.in_world)
+			simulated.push_back(h);
+	}
+
+	// bodies out of simulation at checkpoint time are not added, so restore() has nothing to remove
+	add_bodies(handle_range{simulated.data(), simulated.data() + size(simulated)});
+
+	// bodies at checkpoint place, then collision detection creates pairs and manifolds for contact cache
+	restore(cp, handles.data());
+	_world->performDiscreteCollisionDetection();
+	restore(cp, handles.data());
+
+	return handles;
+}
+
+//! \param handles bodies in checkpoint order, nullptr for checkpoint handles
+void world::restore(world_checkpoint const & cp, body_handle const * handles)
+{
+	_query_snapshot_valid = false;
+	for (size_t i = 0; i < size(cp.bodies); ++i)
+	{
+		world_checkpoint::body_state const & s = cp.bodies[i];
+		body_handle const h = handles ? handles[i] : s.handle;
+		btRigidBody & rb = get(h).rigid_body();
+
+		if (_particles.contains(h))
+			_particles.remove(h);  // tier is assigned again by the next tier update
+
+		if (s.in_world && !rb.isInWorld())
+			add_rigid_body(get(h));
+		else if (!s.in_world && rb.isInWorld())
+			_world->removeRigidBody(&rb);
+
+		btTransform const T{btQuaternion{s.rotation[0], s.rotation[1], s.rotation[2], s.rotation[3]},
+			load_vector(s.origin)};
+		rb.setWorldTransform(T);
+		rb.setInterpolationWorldTransform(T);
+		if (rb.getMotionState())
+			rb.getMotionState()->setWorldTransform(T);
+
+		btVector3 const v = load_vector(s.linear_velocity),
+			w = load_vector(s.angular_velocity);
+		rb.setLinearVelocity(v);
+		rb.setInterpolationLinearVelocity(v);
+		rb.setAngularVelocity(w);
+		rb.setInterpolationAngularVelocity(w);
+		rb.clearForces();
+
+		rb.forceActivationState(s.activation_state);
+		rb.setDeactivationTime(s.deactivation_time);
+
+		if (rb.isInWorld())
+			_world->updateSingleAabb(&rb);
+	}
+
+	// contact cache, manifolds are found through broadphase pairs (O(1) per manifold)
+	_last_collisions.clear();
+	btOverlappingPairCache * pairs = _broadphase->getOverlappingPairCache();
+	for (world_checkpoint::manifold_state const & m : cp.manifolds)
+	{
+		btRigidBody const & a = get(handles ? handles[m.body_a] : cp.bodies[m.body_a].handle).rigid_body(),
+			& b = get(handles ? handles[m.body_b] : cp.bodies[m.body_b].handle).rigid_body();
+
+		if (!a.getBroadphaseHandle() || !b.getBroadphaseHandle())
+			continue;
+
+		btBroadphasePair * pair = pairs->findPair(a.getBroadphaseHandle(), b.getBroadphaseHandle());
+		if (!pair || !pair->m_algorithm)
+			continue;  // contact will be found by the next step
+
+		_checkpoint_manifolds.resize(0);
+		pair->m_algorithm->getAllContactManifolds(_checkpoint_manifolds);
+		for (int i = 0; i < size(_checkpoint_manifolds); ++i)
+		{
+			btPersistentManifold * manifold = _checkpoint_manifolds[i];
+			bool const swapped = manifold->getBody0() == &b;
+
+			manifold->clearManifold();
+			for (uint32_t j = m.first_point; j < m.first_point + m.point_count; ++j)
+				manifold->addManifoldPoint(load_point(cp.points[j], swapped));
+		}
+
+		// already colliding, no begin event after restore (pairs nobody is interested in are not tracked)
+		btCollisionObject const * body_a = &a,
+			* body_b = &b;
+		if (body_a > body_b)
+			swap(body_a, body_b);
+
+		int const groups = collision_group(body_a) | collision_group(body_b);
+		if (groups & (_event_groups | _listener_groups))
+			_last_collisions.insert(make_pair(body_a, body_b), static_cast<uint32_t>(groups));
+	}
+
+	_contact_events.clear();
+	_accumulator = cp.accumulator;
+	_alpha = 0;
+	save_previous_transforms();  // nothing to interpolate from
+}
+
+bool world_checkpoint::save(string const & path) const
+{
+	ofstream fout{path, ios::binary | ios::trunc};
+
+	uint32_t const counts[3] = {static_cast<uint32_t>(size(bodies)), static_cast<uint32_t>(size(manifolds)),
+		static_cast<uint32_t>(size(points))};
+
+	fout.write(magic, sizeof(magic));
+	fout.write(reinterpret_cast<char const *>(&version), sizeof(version));
+	fout.write(reinterpret_cast<char const *>(counts), sizeof(counts));
+	fout.write(reinterpret_cast<char const *>(&accumulator), sizeof(accumulator));
+	fout.write(reinterpret_cast<char const *>(bodies.data()), size(bodies) * sizeof(body_state));
+	fout.write(reinterpret_cast<char const *>(manifolds.data()), size(manifolds) * sizeof(manifold_state));
+	fout.write(reinterpret_cast<char const *>(points.data()), size(points) * sizeof(contact_point));
+
+	return fout.good();
+}
+
+bool world_checkpoint::load(string const & path)
+{
+	ifstream fin{path, ios::binary};
+
+	char file_magic[sizeof(magic)];
+	uint32_t file_version = 0;
+	uint32_t counts[3] = {};
+	fin.read(file_magic, sizeof(file_magic));
+	fin.read(reinterpret_cast<char *>(&file_version), sizeof(file_version));
+	fin.read(reinterpret_cast<char *>(counts), sizeof(counts));
+	fin.read(reinterpret_cast<char *>(&accumulator), sizeof(accumulator));
+	if (!fin || memcmp(file_magic, magic, sizeof(magic)) != 0 || file_version != version)
+		return false;
+
+	// counts needs to match the rest of the file before anything is allocated
+	streampos const data_begin = fin.tellg();
+	fin.seekg(0, ios::end);
+	uint64_t const data_size = static_cast<uint64_t>(fin.tellg() - data_begin);
+	fin.seekg(data_begin);
+	uint64_t const expected_size = uint64_t{counts[0]} * sizeof(body_state)
+		+ uint64_t{counts[1]} * sizeof(manifold_state) + uint64_t{counts[2]} * sizeof(contact_point);
+	if (!fin || data_size != expected_size)
+		return false;
+
+	bodies.resize(counts[0]);
+	manifolds.resize(counts[1]);
+	points.resize(counts[2]);
+	fin.read(reinterpret_cast<char *>(bodies.data()), size(bodies) * sizeof(body_state));
+	fin.read(reinterpret_cast<char *>(manifolds.data()), size(manifolds) * sizeof(manifold_state));
+	fin.read(reinterpret_cast<char *>(points.data()), size(points) * sizeof(contact_point));
+	if (!fin)
+		return false;
+
+	// restore() indexes bodies and points by manifolds
+	for (manifold_state const & m : manifolds)
+	{
+		if (m.body_a >= size(bodies) || m.body_b >= size(bodies) || m.first_point > size(points)
+			|| m.point_count > size(points) - m.first_point)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+}  // physics
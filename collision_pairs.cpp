@@ -0,0 +1,100 @@
+#include <utility>
+#include <cassert>
+#include "collision_pairs.hpp"
+
+namespace physics {
+
+constexpr size_t initial_slot_count = 256;
+
+static size_t hash(collision_pairs::value_type const & p)
+{
+	uint64_t a = reinterpret_cast<uintptr_t>(p.first),
+		b = reinterpret_cast<uintptr_t>(p.second);
+
+	uint64_t h = (a * 0x9e3779b97f4a7c15ull) ^ (b + 0x7f4a7c159e3779b9ull + (a << 6) + (a >> 2));
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 29;
+	return static_cast<size_t>(h);
+}
+
+collision_pairs::collision_pairs()
+	: _slots(initial_slot_count, slot{{nullptr, nullptr}, 0})
+	, _generation{1}
+{
+	_items.reserve(initial_slot_count/2);
+	_tags.reserve(initial_slot_count/2);
+}
+
+void collision_pairs::clear()
+{
+	_items.clear();
+	_tags.clear();
+
+	if (++_generation == 0)  // wrap around, stamps from previous generations would match again
+	{
+		for (slot & s : _slots)
+			s.stamp = 0;
+		_generation = 1;
+	}
+}
+
+bool collision_pairs::insert(value_type const & p, uint32_t tag)
+{
+	// keep load factor under 1/2
+	if (2 * (_items.size() + 1) > _slots.size())
+		grow();
+
+	size_t idx = find_slot(p);
+	slot & s = _slots[idx];
+	if (s.stamp == _generation)
+		return false;  // already there
+
+	s.key = p;
+	s.stamp = _generation;
+	_items.push_back(p);
+	_tags.push_back(tag);
+	return true;
+}
+
+bool collision_pairs::contains(value_type const & p) const
+{
+	return _slots[find_slot(p)].stamp == _generation;
+}
+
+void collision_pairs::swap(collision_pairs & other)
+{
+	using std::swap;
+	swap(_slots, other._slots);
+	swap(_items, other._items);
+	swap(_tags, other._tags);
+	swap(_generation, other._generation);
+}
+
+size_t collision_pairs::find_slot(value_type const & p) const
+{
+	size_t const mask = _slots.size() - 1;
+	size_t idx = hash(p) & mask;
+	while (_slots[idx].stamp == _generation && _slots[idx].key != p)
+		idx = (idx + 1) & mask;
+	return idx;
+}
+
+void collision_pairs::grow()
+{
+	std::vector<slot> slots(2 * _slots.size(), slot{{nullptr, nullptr}, 0});
+	_slots.swap(slots);
+
+	// slots are fresh, so generation can restart
+	_generation = 1;
+	for (value_type const & p : _items)
+	{
+		slot & s = _slots[find_slot(p)];
+		s.key = p;
+		s.stamp = _generation;
+	}
+
+	assert((_slots.size() & (_slots.size() - 1)) == 0 && "power of two expected");
+}
+
+}  // physics
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <bullet/BulletCollision/btBulletCollisionCommon.h>
+
+namespace physics {
+
+/*! Set of collision object pairs, designed to be cleared and refilled every simulation step.
+
+Implemented as an open-addressing hash table (linear probing) keyed on an ordered pair. Slots are
+tagged with a generation stamp, so `clear()` is O(1) and memory is reused between steps. After the
+table grows to the steady state number of contacts, no further allocations happen. Each pair can
+carry a small tag (e.g. collision groups of both bodies), stored next to the insertion order list.
+\code
+collision_pairs pairs;
+pairs.clear();
+pairs.insert(make_pair(a, b));
+assert(pairs.contains(make_pair(a, b)));
+\endcode */
+class collision_pairs
+{
+public:
+	using value_type = std::pair<btCollisionObject const *, btCollisionObject const *>;
+	using const_iterator = value_type const *;
+
+	collision_pairs();
+	void clear();  //!< O(1), capacity is kept
+
+	//! \return true if pair was inserted, false if it was already there (tag is not changed)
+	bool insert(value_type const & p, uint32_t tag = 0);
+	bool contains(value_type const & p) const;
+
+	size_t size() const {return _items.size();}
+	bool empty() const {return _items.empty();}
+
+	//! iterates pairs in the insertion order
+	const_iterator begin() const {return _items.data();}
+	const_iterator end() const {return _items.data() + _items.size();}
+	uint32_t tag(size_t idx) const {return _tags[idx];}  //!< tag of the idx-th pair in the insertion order
+
+	void swap(collision_pairs & other);
+
+private:
+	struct slot
+	{
+		value_type key;
+		uint32_t stamp;  //!< slot is used only if stamp matches current generation
+	};
+
+	size_t find_slot(value_type const & p) const;  //!< index of slot with p or first free slot
+	void grow();
+
+	std::vector<slot> _slots;  //!< power of two sized
+	std::vector<value_type> _items;  //!< dense list of pairs for iteration
+	std::vector<uint32_t> _tags;  //!< per item tag
+	uint32_t _generation;
+};
+
+inline void swap(collision_pairs & a, collision_pairs & b)
+{
+	a.swap(b);
+}
+
+}  // physics
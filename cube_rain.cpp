@@ -1,15 +1,18 @@
 // physics in cube rain scence
 #include <vector>
-#include <set>
-#include <map>
+#include <algorithm>
 #include <utility>
 #include <string>
 #include <memory>
+#include <optional>
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <fstream>
 #include <Ogre.h>
 #include <OgreApplicationContext.h>
+#include <OgreInstanceManager.h>
+#include <OgreInstancedEntity.h>
 #include <OgreCameraMan.h>
 #include <OgreTrays.h>
 #include <OgreImGuiOverlay.h>
@@ -17,16 +20,20 @@
 #include "axis.hpp"
 #include "physics.hpp"
 #include "cast.hpp"
+#include "cube_store.hpp"
+#include "timing_wheel.hpp"
+#include "trace.hpp"
 
-using std::vector, std::set, std::map;
+using std::vector, std::size;
+using std::min, std::max, std::count_if;
 using std::pair;
 using std::string, std::to_string;
 using std::unique_ptr, std::make_unique;
+using std::optional;
 using std::random_device, std::default_random_engine;
 using std::cout, std::endl;
-using std::chrono::steady_clock, std::chrono::duration;
-
-using namespace std::chrono_literals;
+using std::ifstream;
+using std::chrono::duration, std::chrono::steady_clock;
 
 using Ogre::SceneManager,  // Ogre::vector name collision with std::vector so `using namespace Ogre` cannot be used there
 	Ogre::SceneNode,
@@ -35,8 +42,13 @@ using Ogre::SceneManager,  // Ogre::vector name collision with std::vector so `u
 	Ogre::Light,
 	Ogre::Camera,
 	Ogre::Entity,
+	Ogre::SubEntity,
+	Ogre::InstanceManager,
+	Ogre::InstancedEntity,
 	Ogre::ColourValue,
 	Ogre::Vector3,
+	Ogre::Quaternion,
+	Ogre::Vector4,
 	Ogre::Real,
 	Ogre::Node,
 	Ogre::OverlayManager,
@@ -48,6 +60,14 @@ using namespace OgreBites;
 
 
 Vector3 const camera_position = {0, 0, 10};
+Vector4 const no_impact = {-1000, 0, 0, 0};  // impact time parameter for not collided cube, see media/cube.vert
+Real const highlight_duration = 0.25;  // in s, the same as highlightDuration in media/cube.material
+uint32_t const no_cube = ~0u;
+Real const pick_distance = 1000;
+int const sync_grain = 1024;  // cubes per sync_cubes() task
+duration<double> const spawn_budget{2e-3};  // cube pool work per frame, see update_cube_count()
+size_t const spawn_batch = 64;  // cubes per pool operation, budget is checked between batches
+int const pooled_cube = -1;  // body user index of inactive cube
 
 // flyweight pattern
 struct cube_object
@@ -57,26 +77,37 @@ struct cube_object
 };
 
 // helpers
-cube_object new_cube();
+cube_object new_cube(default_random_engine & rand);
+default_random_engine & thread_random_engine();
 btTransform translate(Vector3 const & v);
+btVector3 fall_velocity(cube_object const & cube);
 
-struct collision_record
+struct cube_rain_options
 {
-	steady_clock::time_point t_impact;
+	bool instanced = false;  // render cubes with hardware instancing
+	bool particles = false;  // simulate distant and isolated cubes as particles (see physics::particle_options)
+	string record_path;  // physics trace output file
+	string replay_path;  // physics trace to replay instead of simulation
+	string scene_path = "cube_rain.scene";  // world checkpoint loaded at startup (if exists) and saved from GUI
 };
 
+physics::world_options make_world_options(cube_rain_options const & opts, btITaskScheduler * scheduler);
+
 
 class cube_rain
 	: public ApplicationContext, public InputListener, public RenderTargetListener
 {
 public:
-	cube_rain();
+	explicit cube_rain(cube_rain_options const & opts = cube_rain_options{});
 	void go();  //!< app entry point
 
 private:
 	void setup_scene(SceneManager & scene);
 	void update(duration<double> dt);
+	void sync_cubes(physics::world_snapshot const & snapshot);
+	void replay();
 	void update_gui();
+	void update_profiler_gui();
 
 	// ApplicationContext overrides
 	void setup() override;
@@ -95,26 +126,72 @@ private:
 	void preViewportUpdate(RenderTargetViewportEvent const & evt) override;
 
 	// helpers
-	void add_cubes(size_t n);
-	void remove_cubes(size_t n);
-	SceneNode * create_cube_node(SceneManager & scene, cube_object const & cube);
-	physics::body * create_cube_body(cube_object const & cube, SceneNode * nd);
+	void highlight_cube(uint32_t cube_id, Vector4 const & impact);
+	Vector4 impact_now() const;
+	void update_cube_count();
+	bool load_scene(string const & path);
+	void clear_highlight(uint32_t cube_id);
+	void pick_cube(Ogre::Ray const & r);
+	void select_cube(uint32_t cube_id);
+	void grow_pool(size_t n);
+	void activate_cubes(size_t n);
+	void deactivate_cubes(size_t n);
+	void remove_cube(uint32_t cube_id);
+	void swap_cubes(uint32_t a, uint32_t b);
+	size_t max_cube_count() const;
+	cube_visual create_cube_visual(cube_object const & cube);
+	cube_visual create_cube_node(SceneManager & scene, cube_object const & cube);
+	InstancedEntity * create_cube_instance(cube_object const & cube);
+	physics::body_handle create_cube_body(cube_object const & cube);
 
 	unique_ptr<CameraMan> _cameraman;
-	vector<cube_object> _cubes;  // cube pool
-	vector<SceneNode *> _cube_nodes;
-	map<SceneNode *, collision_record> _highlighted_cube_nodes;
+	cube_store _cubes;  // cube pool, cube id is body user index
+	size_t _active_cubes = 0;  // cubes [0, _active_cubes) are simulated and rendered, the rest is hidden
+	timing_wheel _highlighted_cubes{32, 1.0/64.0};  // cube indices with highlight in progress, 0.5s span
 	InputListenerChain _input_listeners;
 	unique_ptr<ImGuiInputListener> _imgui_listener;
 	SceneManager * _scene = nullptr;
+	InstanceManager * _cube_instances = nullptr;  // instanced mode only
 
 	// settings
+	bool const _instanced;  // render cubes with hardware instancing
+	bool const _particles;  // particle tier enabled
 	int _cube_count = 300;
 	double _time_dilation = 1.0;
 
 	// physics related stuff ...
+	physics::task_scheduler _sync_pool;  // sync_cubes() stage and world queries, needs to outlive _world
+	unique_ptr<physics::trace_recorder> _recorder;  // needs to outlive _world
 	physics::world _world;
-	vector<physics::body *> _cube_bodies;  // btRigidBody is not default constructible, that is why *
+	physics::fixed_step_stats _step_stats = {};
+	size_t _particle_count = 0;  // cached in update(), world can't be read while stepping
+	vector<Vector3> _body_positions;  // indexed by body_handle::index
+	vector<Quaternion> _body_orientations;
+
+	// sync_cubes() stage, cubes are partitioned into sync_grain chunks processed by `_sync_pool` threads
+	vector<Quaternion> _cube_orientations;  // cube orientations to render, indexed by cube
+	vector<vector<uint32_t>> _recycled_cubes;  // per chunk, merged by the main thread
+
+	// reused to teleport all recycled (or activated) cubes at once
+	vector<physics::body_handle> _teleported_bodies;
+	vector<btTransform> _teleport_transforms;
+	vector<btVector3> _teleport_velocities;
+
+	// pre-settled scene
+	string const _scene_path;
+	bool _save_scene = false;  // requested from GUI
+	physics::world_checkpoint _checkpoint;
+
+	// picking
+	Camera * _camera = nullptr;
+	optional<Ogre::Ray> _pick_ray;  // from mousePressed(), casted by update() while world is idle
+	uint32_t _selected_cube = no_cube;
+	bool _remove_selected = false;  // from keyPressed(), handled by update() while world is idle
+
+	// replay mode
+	unique_ptr<physics::trace_player> _player;
+	physics::trace_frame _replay_frame;
+	size_t _replay_frame_idx = 0;
 };
 
 namespace std {
@@ -124,90 +201,226 @@ string to_string(CameraStyle style);
 }  // std
 
 
-struct collision_collector : public physics::collision_listener
+void cube_rain::update(duration<double> dt)
 {
-	set<btCollisionObject *> result;
-
-	void clear()
+	if (_player)
 	{
-		result.clear();
+		replay();
+		return;
 	}
 
-	void on_collision(btCollisionObject * a, btCollisionObject * b) override
+	_world.wait();  // world is not simulated from now till step_async() call bellow
+
+#ifdef PHYSICS_PROFILING
+	physics::profiler::get().end_frame();  // physics thread is idle, frame contains the whole physics step
+#endif
+
+	PHYSICS_PROFILE_SCOPE("update");
+
+	if (_save_scene)  // world is idle here
 	{
-		result.insert({a, b});
+		_world.checkpoint(_checkpoint);
+		if (_checkpoint.save(_scene_path))
+			cout << "scene saved to '" << _scene_path << "'" << endl;
+		_save_scene = false;
 	}
-};
 
-void cube_rain::update(duration<double> dt)
-{
-	// handle number of cubes option (if changed)
-	int prev_cube_count = size(_cubes);
+	if (_pick_ray)
+	{
+		pick_cube(*_pick_ray);
+		_pick_ray.reset();
+	}
 
-	if (_cube_count < prev_cube_count)
-		remove_cubes(prev_cube_count - _cube_count);
-	else if (_cube_count > prev_cube_count)
-		add_cubes(_cube_count - prev_cube_count);
+	physics::world_snapshot const & snapshot = _world.latest_snapshot();
+	_step_stats = snapshot.stats;
+	_particle_count = _world.particle_count();  // world is idle here
 
-	collision_collector collisions;
-	_world.subscribe_collisions(&collisions);
+	// find out all collided cubes and highlight them, highlight fades out in shader
+	Vector4 const impact = impact_now();
+	for (physics::contact_event const & e : snapshot.events)
+	{
+		if (e.type != physics::contact_event::begin)
+			continue;
 
-	_world.simulate(dt.count());
+		highlight_cube(e.a->getUserIndex(), impact);
+		highlight_cube(e.b->getUserIndex(), impact);
+	}
 
-	// highlight all collided cubes
-	steady_clock::time_point now = steady_clock::now();
+	// cost is proportional to the number of expired highlights
+	_highlighted_cubes.expire(impact.x, [this](uint32_t cube_id){clear_highlight(cube_id);});
 
-	// find out all collided cubes and highlight them
-	for (btCollisionObject * o : collisions.result)
+	// after contact events, they refer to cubes by body user index
+	if (_remove_selected)
 	{
-		SceneNode * nd = static_cast<SceneNode *>(o->getUserPointer());
-		_highlighted_cube_nodes.insert_or_assign(nd, collision_record{now});
-		dynamic_cast<Entity *>(nd->getAttachedObject(0))->setMaterialName("cube_collision_color");
+		if (_selected_cube != no_cube)
+		{
+			remove_cube(_selected_cube);
+			_cube_count = max(_cube_count - 1, 0);  // count change can be still in progress
+		}
+		_remove_selected = false;
 	}
 
-	// removes old highlights (after 1s)
-	vector<map<SceneNode *, collision_record>::const_iterator> old_highlights;
-	for (auto it = cbegin(_highlighted_cube_nodes); it != cend(_highlighted_cube_nodes); ++it)
+	sync_cubes(snapshot);
+	update_cube_count();  // activated cubes are placed by activate_cubes(), not by snapshot
+
+	_world.set_focus(to_bullet(_camera->getDerivedPosition()));  // cubes around camera are rigid bodies
+
+	// physics runs in parallel with rendering of this frame
+	_world.step_async(dt.count());
+}
+
+//! plays one recorded frame per rendered frame (as fast as rendering goes), physics is not simulated
+void cube_rain::replay()
+{
+	PHYSICS_PROFILE_SCOPE("replay");
+
+	_player->read_frame(_replay_frame_idx, _replay_frame);
+	_replay_frame_idx = (_replay_frame_idx + 1) % _player->frame_count();  // loop
+
+	// recorded body ids are cube indices, traces recorded with pooled bodies have them as pooled_cube
+	vector<uint32_t> const & ids = _replay_frame.ids;
+	_cube_count = static_cast<int>(count_if(begin(ids), end(ids),
+		[](uint32_t id){return id != static_cast<uint32_t>(pooled_cube);}));
+	update_cube_count();
+
+	Vector4 const impact = impact_now();
+	for (physics::trace_frame::event const & e : _replay_frame.events)
 	{
-		if (now - it->second.t_impact > 250ms)
+		if (e.type == physics::contact_event::begin && e.a < _active_cubes && e.b < _active_cubes)
 		{
-			old_highlights.push_back(it);
-			dynamic_cast<Entity *>(it->first->getAttachedObject(0))->setMaterialName("cube_color");
+			highlight_cube(e.a, impact);
+			highlight_cube(e.b, impact);
 		}
 	}
 
-	for (auto it : old_highlights)
-		_highlighted_cube_nodes.erase(it);
+	_highlighted_cubes.expire(impact.x, [this](uint32_t cube_id){clear_highlight(cube_id);});
 
+	size_t const body_count = _replay_frame.body_count();
+	_body_positions.resize(body_count);
+	_body_orientations.resize(body_count);
+	to_ogre(_replay_frame.positions.data(), body_count, _body_positions.data());
+	to_ogre(_replay_frame.orientations.data(), body_count, _body_orientations.data());
 
-	_world.unsubscribe_collisions(&collisions);
+	for (size_t i = 0; i < body_count; ++i)
+	{
+		uint32_t const cube_id = _replay_frame.ids[i];
+		if (cube_id < _active_cubes)
+			_cubes.visual(cube_id).set_transform(_body_positions[i], _body_orientations[i]);
+	}
+}
 
-	// update cubes (position, rotations)
-	assert(size(_cubes) == size(_cube_nodes) && size(_cubes) == size(_cube_bodies));
+/*! handle number of cubes option (if changed), cubes are (de)activated in batches till spawn_budget
+is spent, so big count changes are spread over frames. Remaining budget pre-warms the cube pool. */
+void cube_rain::update_cube_count()
+{
+	PHYSICS_PROFILE_SCOPE("update_cube_count");
 
-	constexpr Real fall_off_threshold = -10.0;
+	auto const deadline = steady_clock::now() + spawn_budget;
+	size_t const cube_count = static_cast<size_t>(_cube_count),
+		pool_size = max(max_cube_count(), cube_count);
 
-	auto cube_node_it = begin(_cube_nodes);
-	auto cube_body_it = begin(_cube_bodies);
-	for (cube_object & cube : _cubes)
+	do  // at least one batch per frame
 	{
-		if (cube.position.y > fall_off_threshold)
+		if (cube_count < _active_cubes)
+			deactivate_cubes(min(_active_cubes - cube_count, spawn_batch));
+		else if (cube_count > _active_cubes)
 		{
-			cube.position = to_ogre((*cube_body_it)->position());
+			if (_active_cubes == size(_cubes))  // pool is not warm yet
+				grow_pool(min(cube_count - _active_cubes, spawn_batch));
+			activate_cubes(min({cube_count - _active_cubes, size(_cubes) - _active_cubes, spawn_batch}));
 		}
-		else  // reuse cubes too far from start position
+		else if (size(_cubes) < pool_size)
+			grow_pool(min(pool_size - size(_cubes), spawn_batch));
+		else
+			break;
+	}
+	while (steady_clock::now() < deadline);
+}
+
+/*! updates cubes position and rotation from physics snapshot, recycles fallen cubes
+
+Cubes are processed in parallel by `_sync_pool` threads (world is idle, so snapshot and bodies are only
+read), each chunk writes its cubes and its own recycle list. OGRE scene updates are not thread safe, so
+visuals are updated and recycled bodies teleported by the main thread afterwards. */
+void cube_rain::sync_cubes(physics::world_snapshot const & snapshot)
+{
+	PHYSICS_PROFILE_SCOPE("sync_cubes");
+
+	// convert snapshot transforms to OGRE types in one pass
+	size_t const slot_count = snapshot.slot_count();
+	_body_positions.resize(slot_count);
+	_body_orientations.resize(slot_count);
+	to_ogre(snapshot.positions.data(), slot_count, _body_positions.data());
+	to_ogre(snapshot.orientations.data(), slot_count, _body_orientations.data());
+
+	int const cube_count = static_cast<int>(_active_cubes);
+	_cube_orientations.resize(cube_count);
+	_recycled_cubes.resize(max(1, (cube_count + sync_grain - 1) / sync_grain));  // parallel_for() calls sync even for no cubes
+	for (vector<uint32_t> & recycled : _recycled_cubes)
+		recycled.clear();
+
+	auto sync = [this, &snapshot](int first, int last){
+		constexpr Real fall_off_threshold = -10.0;
+
+		vector<uint32_t> & recycled = _recycled_cubes[first / sync_grain];  // serial run gets all cubes into the first chunk
+		default_random_engine & rand = thread_random_engine();
+
+		for (int i = first; i < last; ++i)
 		{
-			cube = new_cube();
-			(*cube_body_it)->rigid_body().setWorldTransform(translate(cube.position));
+			physics::body_handle const body = _cubes.body(i);
+
+			// transform to render
+			Vector3 position;
+			Quaternion orientation;
+			if (snapshot.contains(body))
+			{
+				position = _body_positions[body.index];
+				orientation = _body_orientations[body.index];
+			}
+			else  // new cubes are not in snapshot yet
+			{
+				btTransform const T = _world.transform(body);
+				position = to_ogre(T.getOrigin());
+				orientation = to_ogre(T.getRotation());
+			}
+
+			if (position.y < fall_off_threshold)  // reuse cubes too far from start position
+			{
+				position = new_cube(rand).position;  // cube keeps its scale, body shape and visual are not rescaled
+				orientation = Quaternion::IDENTITY;
+				recycled.push_back(static_cast<uint32_t>(i));
+			}
+
+			_cubes.position(i) = position;
+			_cube_orientations[i] = orientation;
 		}
+	};
 
-		btQuaternion orientation = (*cube_body_it)->rigid_body().getOrientation();
-		++cube_body_it;
+	{
+		PHYSICS_PROFILE_SCOPE("sync_cubes parallel");
+		_sync_pool.parallel_for(0, cube_count, sync_grain, sync);
+	}
 
-		(*cube_node_it)->setPosition(cube.position);  // update cube position
-		(*cube_node_it)->setOrientation(to_ogre(orientation));
-		++cube_node_it;
+	// recycle decisions in cube order
+	_teleported_bodies.clear();
+	_teleport_transforms.clear();
+	_teleport_velocities.clear();
+	for (vector<uint32_t> const & recycled : _recycled_cubes)
+	{
+		for (uint32_t cube_id : recycled)
+		{
+			cube_object const cube{_cubes.position(cube_id), _cubes.scale(cube_id)};
+			_teleported_bodies.push_back(_cubes.body(cube_id));
+			_teleport_transforms.push_back(translate(cube.position));
+			_teleport_velocities.push_back(fall_velocity(cube));
+		}
 	}
+
+	for (int i = 0; i < cube_count; ++i)
+		_cubes.visual(i).set_transform(_cubes.position(i), _cube_orientations[i]);
+
+	_world.teleport_bodies(boost::make_iterator_range(_teleported_bodies.data(),
+		_teleported_bodies.data() + size(_teleported_bodies)), _teleport_transforms.data(), _teleport_velocities.data());
 }
 
 void cube_rain::setup_scene(SceneManager & scene)
@@ -230,6 +443,7 @@ void cube_rain::setup_scene(SceneManager & scene)
 	camera->setNearClipDistance(0.1);  // specific to this sample
 	camera->setAutoAspectRatio(true);
 	camera_nd->attachObject(camera);
+	_camera = camera;
 
 	_cameraman = make_unique<CameraMan>(camera_nd);
 	_cameraman->setStyle(CS_ORBIT);
@@ -237,7 +451,17 @@ void cube_rain::setup_scene(SceneManager & scene)
 
 	getRenderWindow()->addViewport(camera);  // render into the main window
 
-	add_cubes(_cube_count);
+	if (_instanced)
+	{
+		// all cubes share one mesh and material, cube transforms are uploaded as per instance data
+		constexpr size_t instances_per_batch = 1024;
+		_cube_instances = scene.createInstanceManager("cubes", "Prefab_Cube", Ogre::RGN_INTERNAL,
+			InstanceManager::HWInstancingBasic, instances_per_batch);
+		_cube_instances->setSetting(InstanceManager::CAST_SHADOWS, false);
+		_cube_instances->setNumCustomParams(1);  // impact time
+	}
+
+	load_scene(_scene_path);  // pre-settled scene, otherwise cubes are activated by update_cube_count()
 
 	// axis
 	AxisObject axis;
@@ -250,13 +474,74 @@ void cube_rain::update_gui()
 {
 	ImGui::Begin("Info");  // begin window
 
-	ImGui::SliderInt("Number of cubes", &_cube_count, 100, 1500);
+	ImGui::SliderInt("Number of cubes", &_cube_count, 100, static_cast<int>(max_cube_count()));
+	ImGui::Text("Cube pool: %zu active, %zu pooled", _active_cubes, size(_cubes) - _active_cubes);
+	ImGui::Text("Physics steps: %d (dropped %.1f ms)", _step_stats.steps, _step_stats.dropped_time * 1e3);
+	ImGui::Text("Highlighted cubes: %zu", _highlighted_cubes.size());
+	if (_particles)
+		ImGui::Text("Particle cubes: %zu", _particle_count);
+
+	if (_selected_cube != no_cube)
+	{
+		Vector3 const & p = _cubes.position(_selected_cube);
+		ImGui::Text("Selected cube: %u at (%.1f, %.1f, %.1f), delete to remove", _selected_cube, p.x, p.y, p.z);
+	}
+	else
+		ImGui::Text("Selected cube: none (click to select)");
+
+	if (ImGui::Button("Save scene"))  // loaded on next start
+		_save_scene = true;
+
+	// draw calls of the last frame
+	Ogre::RenderTarget::FrameStats const & stats = getRenderWindow()->getStatistics();
+	ImGui::Text("Batches: %zu, triangles: %zu (%s)", stats.batchCount, stats.triangleCount,
+		_instanced ? "instanced" : "entities");
 
 	ImGui::End();  // end window
 
+#ifdef PHYSICS_PROFILING
+	update_profiler_gui();
+#endif
+
 	ImGui::Render();
 }
 
+void cube_rain::update_profiler_gui()
+{
+	physics::profiler & prof = physics::profiler::get();
+
+	ImGui::Begin("Profiler");
+
+	ImGui::Columns(5);
+	for (char const * title : {"zone", "calls", "p50 ms", "p90 ms", "p99 ms"})
+	{
+		ImGui::Text("%s", title);
+		ImGui::NextColumn();
+	}
+	ImGui::Separator();
+
+	for (physics::profiler::zone_stats const & z : prof.statistics())
+	{
+		ImGui::Text("%s", z.name);
+		ImGui::NextColumn();
+		ImGui::Text("%zu", z.calls);
+		ImGui::NextColumn();
+		for (double v : {z.p50, z.p90, z.p99})
+		{
+			ImGui::Text(z.counter ? "%.0f" : "%.3f", v);  // counters are not in ms
+			ImGui::NextColumn();
+		}
+	}
+	ImGui::Columns(1);
+
+	if (prof.capturing())
+		ImGui::Text("capturing trace ...");
+	else if (ImGui::Button("Capture trace (120 frames)"))
+		prof.capture_trace(120, "cube_rain_trace.json");  // open in chrome://tracing
+
+	ImGui::End();
+}
+
 void cube_rain::setup()
 {
 	ApplicationContext::setup();
@@ -280,6 +565,11 @@ void cube_rain::setup()
 	Ogre::RTShader::ShaderGenerator * shadergen = Ogre::RTShader::ShaderGenerator::getSingletonPtr();
 	shadergen->addSceneManager(_scene);
 
+#ifdef PHYSICS_PROFILING
+	physics::profiler::get().attach_thread("render");
+	physics::profiler::get().hook_bullet();  // Bullet step phases (broadphase, narrowphase, solver, ...)
+#endif
+
 	setup_scene(*_scene);
 
 	// input listeners
@@ -297,10 +587,30 @@ void cube_rain::go()
 	closeApp();
 }
 
-cube_rain::cube_rain()
+cube_rain::cube_rain(cube_rain_options const & opts)
 	: ApplicationContext{"ogre cuberain"}
+	, _instanced{opts.instanced}
+	, _particles{opts.particles}
+	, _world{make_world_options(opts, &_sync_pool)}
+	, _scene_path{opts.scene_path}
 {
 	_world.native().setGravity(btVector3{0,0,0});  // turn off gravity
+
+	if (!opts.record_path.empty())
+	{
+		_recorder = make_unique<physics::trace_recorder>(opts.record_path);
+		_world.record(_recorder.get());
+	}
+
+	if (!opts.replay_path.empty())
+	{
+		_player = make_unique<physics::trace_player>(opts.replay_path);
+		if (!_player->good() || _player->frame_count() == 0)
+		{
+			cout << "unable to replay '" << opts.replay_path << "' trace, simulating instead" << endl;
+			_player.reset();
+		}
+	}
 }
 
 bool cube_rain::keyPressed(KeyboardEvent const & evt)
@@ -317,6 +627,8 @@ bool cube_rain::keyPressed(KeyboardEvent const & evt)
 		else
 			_time_dilation = 0.0;
 	}
+	else if (evt.keysym.sym == SDLK_DELETE)
+		_remove_selected = true;
 	else
 		_input_listeners.keyPressed(evt);
 
@@ -335,7 +647,14 @@ bool cube_rain::mouseMoved(MouseMotionEvent const & evt)
 
 bool cube_rain::mousePressed(MouseButtonEvent const & evt)
 {
-	return _input_listeners.mousePressed(evt);
+	if (evt.button == BUTTON_LEFT && !ImGui::GetIO().WantCaptureMouse && !_player)
+	{
+		Ogre::RenderWindow * win = getRenderWindow();
+		_pick_ray = _camera->getCameraToViewportRay(evt.x / Real(win->getWidth()),
+			evt.y / Real(win->getHeight()));
+	}
+
+	return _input_listeners.mousePressed(evt);  // camera still orbits
 }
 
 bool cube_rain::mouseReleased(MouseButtonEvent const & evt)
@@ -370,84 +689,322 @@ void cube_rain::preViewportUpdate(RenderTargetViewportEvent const & evt)
 	update_gui();
 }
 
-void cube_rain::add_cubes(size_t n)
+//! creates `n` inactive (hidden and not simulated) cubes
+void cube_rain::grow_pool(size_t n)
 {
-	size_t prev_cube_count = size(_cubes),
-		cube_count = prev_cube_count + n;
+	assert(_scene);
 
-	assert(size(_cubes) == size(_cube_nodes) && size(_cubes) == size(_cube_bodies));
-	_cubes.resize(cube_count);
-	_cube_nodes.resize(cube_count);
-	_cube_bodies.resize(cube_count);
+	for (size_t i = 0; i < n; ++i)
+	{
+		cube_object const cube = new_cube(thread_random_engine());
+		cube_visual const visual = create_cube_visual(cube);
+		visual.set_visible(false);
+		_cubes.add(cube.position, cube.scale, create_cube_body(cube), visual);
+	}
+}
 
-	assert(_scene);
+//! shows `n` pooled cubes at a new start position and adds them to simulation
+void cube_rain::activate_cubes(size_t n)
+{
+	size_t const first = _active_cubes,
+		last = first + n;
+	assert(last <= size(_cubes));
+
+	_teleported_bodies.clear();
+	_teleport_transforms.clear();
+	_teleport_velocities.clear();
 
-	for (size_t i = 0; i < n; ++i)  // for new cubes
+	default_random_engine & rand = thread_random_engine();
+	for (size_t i = first; i < last; ++i)
 	{
-		size_t const idx = prev_cube_count + i;
+		uint32_t const cube_id = static_cast<uint32_t>(i);
+		cube_object const cube{new_cube(rand).position, _cubes.scale(cube_id)};  // pooled cube keeps its scale (body shape)
+		_cubes.position(cube_id) = cube.position;
+
+		cube_visual const & visual = _cubes.visual(cube_id);
+		visual.set_transform(cube.position, Quaternion::IDENTITY);
+		visual.set_visible(true);
+
+		physics::body_handle const body = _cubes.body(cube_id);
+		_world.get(body).rigid_body().setUserIndex(static_cast<int>(cube_id));
+		_teleported_bodies.push_back(body);
+		_teleport_transforms.push_back(translate(cube.position));
+		_teleport_velocities.push_back(fall_velocity(cube));
+	}
 
-		cube_object & cube = _cubes[idx];
-		cube = new_cube();
+	// bodies are not in simulation yet, so there are no pairs to remove
+	_world.teleport_bodies(boost::make_iterator_range(_teleported_bodies.data(),
+		_teleported_bodies.data() + size(_teleported_bodies)), _teleport_transforms.data(), _teleport_velocities.data());
+
+	physics::body_handle const * bodies = _cubes.bodies().data();
+	_world.add_bodies(boost::make_iterator_range(bodies + first, bodies + last));
+	_active_cubes = last;
+}
 
-		SceneNode * nd = create_cube_node(*_scene, cube);
-		_cube_nodes[idx] = nd;
-		_cube_bodies[idx] = create_cube_body(cube, nd);
+//! casts picking ray against cube bodies
+void cube_rain::pick_cube(Ogre::Ray const & r)
+{
+	physics::ray const pick{to_bullet(r.getOrigin()), to_bullet(r.getPoint(pick_distance))};
+	physics::ray_hit hit;
+	_world.raycast_batch(physics::world::ray_range{&pick, &pick + 1}, &hit);
+	select_cube(hit.hit() ? static_cast<uint32_t>(hit.object->getUserIndex()) : no_cube);
+}
+
+//! selected cube shows bounding box (entities only) and flashes
+void cube_rain::select_cube(uint32_t cube_id)
+{
+	if (_selected_cube != no_cube && _cubes.visual(_selected_cube).node)
+		_cubes.visual(_selected_cube).node->showBoundingBox(false);
+
+	_selected_cube = cube_id;
+	if (_selected_cube == no_cube)
+		return;
+
+	if (_cubes.visual(_selected_cube).node)
+		_cubes.visual(_selected_cube).node->showBoundingBox(true);
+	highlight_cube(_selected_cube, impact_now());
+}
+
+//! hides the last `n` active cubes and removes them from simulation, cubes stay in the pool
+void cube_rain::deactivate_cubes(size_t n)
+{
+	assert(n <= _active_cubes);
+
+	size_t const cube_count = _active_cubes - n;
+
+	if (_selected_cube != no_cube && _selected_cube >= cube_count)
+		select_cube(no_cube);
+
+	for (size_t i = cube_count; i < _active_cubes; ++i)
+	{
+		uint32_t const cube_id = static_cast<uint32_t>(i);
+		_highlighted_cubes.cancel(cube_id);
+		clear_highlight(cube_id);
+		_cubes.visual(cube_id).set_visible(false);
+		_world.get(_cubes.body(cube_id)).rigid_body().setUserIndex(pooled_cube);
 	}
+
+	physics::body_handle const * bodies = _cubes.bodies().data();
+	_world.remove_bodies(boost::make_iterator_range(bodies + cube_count,
+		bodies + _active_cubes));  // linear, not one Bullet array search per body
+	_active_cubes = cube_count;
+}
+
+//! deactivates any active cube in O(1), the last active cube takes over `cube_id`
+void cube_rain::remove_cube(uint32_t cube_id)
+{
+	assert(cube_id < _active_cubes);
+	swap_cubes(cube_id, static_cast<uint32_t>(_active_cubes - 1));
+	deactivate_cubes(1);
 }
 
-void cube_rain::remove_cubes(size_t n)
+//! exchanges ids of two cubes, body user index, highlight and selection are moved with the cube
+void cube_rain::swap_cubes(uint32_t a, uint32_t b)
 {
-	assert(n <= size(_cube_nodes));
+	if (a == b)
+		return;
 
-	size_t cube_count = size(_cube_nodes) - n;
+	_cubes.swap(a, b);
 
-	SceneNode & root = *_scene->getRootSceneNode();
-	for_each(begin(_cube_nodes) + cube_count, end(_cube_nodes),
-		[&root](SceneNode * nd){root.removeChild(nd);});
-	_cube_nodes.resize(cube_count);
+	for (uint32_t cube_id : {a, b})
+	{
+		_world.get(_cubes.body(cube_id)).rigid_body().setUserIndex(static_cast<int>(cube_id));
 
-	for_each(begin(_cube_bodies) + cube_count, end(_cube_bodies),
-		[this](physics::body * b){
-			_world.remove_body(b);
-			delete b;
-	});
-	_cube_bodies.resize(cube_count);
+		_highlighted_cubes.cancel(cube_id);
+		if (_cubes.highlight_end(cube_id) != cube_store::no_highlight)
+			_highlighted_cubes.schedule(cube_id, _cubes.highlight_end(cube_id));
+	}
 
-	_cubes.resize(cube_count);
+	if (_selected_cube == a)
+		_selected_cube = b;
+	else if (_selected_cube == b)
+		_selected_cube = a;
+}
 
-	assert(size(_cubes) == size(_cube_nodes) && size(_cubes) == size(_cube_bodies));
+//! slider maximum, cube pool is pre-warmed up to this size
+size_t cube_rain::max_cube_count() const
+{
+	return _instanced ? (_particles ? 150000 : 50000) : 1500;
 }
 
-SceneNode * cube_rain::create_cube_node(SceneManager & scene, cube_object const & cube)
+//! single shader parameter write, no material change
+void cube_rain::highlight_cube(uint32_t cube_id, Vector4 const & impact)
+{
+	cube_visual const & visual = _cubes.visual(cube_id);
+	if (visual.instance)
+		visual.instance->setCustomParam(0, impact);
+	else
+		visual.model->setCustomParameter(0, impact);
+
+	double const highlight_end = impact.x + highlight_duration;
+	_cubes.highlight_end(cube_id) = highlight_end;
+	_highlighted_cubes.schedule(cube_id, highlight_end);
+}
+
+//! impact time parameter for cubes collided this frame, shader `time` clock
+Vector4 cube_rain::impact_now() const
+{
+	return Vector4{Ogre::ControllerManager::getSingleton().getElapsedTime(), 0, 0, 0};
+}
+
+//! called when highlight is over, shader already faded it out so just forget impact time
+void cube_rain::clear_highlight(uint32_t cube_id)
+{
+	cube_visual const & visual = _cubes.visual(cube_id);
+	if (visual.instance)
+		visual.instance->setCustomParam(0, no_impact);
+	else
+		visual.model->setCustomParameter(0, no_impact);
+
+	_cubes.highlight_end(cube_id) = cube_store::no_highlight;
+}
+
+/*! creates cubes from saved world checkpoint (see "Save scene" button), checkpoint bodies user index
+needs to be cube index or pooled_cube for inactive cubes */
+bool cube_rain::load_scene(string const & path)
+{
+	assert(_cubes.empty());
+
+	physics::world_checkpoint & cp = _checkpoint;
+	if (!cp.load(path))
+	{
+		if (ifstream{path})  // missing scene is fine
+			cout << "unable to load scene from '" << path << "', corrupt file" << endl;
+		return false;
+	}
+
+	// active cubes are added in user index order (so cube id matches saved user index), pooled cubes after them
+	size_t const body_count = size(cp.bodies),
+		cube_count = count_if(begin(cp.bodies), end(cp.bodies),
+			[](physics::world_checkpoint::body_state const & s){return s.user_index != pooled_cube;});
+
+	vector<size_t> body_by_cube(body_count, body_count);
+	size_t pooled_idx = cube_count;
+	for (size_t i = 0; i < body_count; ++i)
+	{
+		int const user_index = cp.bodies[i].user_index;
+		if (user_index == pooled_cube)
+			body_by_cube[pooled_idx++] = i;
+		else if (user_index < 0 || static_cast<size_t>(user_index) >= cube_count || body_by_cube[user_index] != body_count)
+			return false;
+		else
+			body_by_cube[user_index] = i;
+	}
+
+	vector<physics::body_handle> bodies = _world.instantiate(cp);
+
+	_cubes.reserve(body_count);
+
+	for (size_t i : body_by_cube)
+	{
+		physics::world_checkpoint::body_state const & s = cp.bodies[i];
+
+		cube_object const cube{Vector3{s.origin[0], s.origin[1], s.origin[2]}, s.shape_dims[0] / 0.5f};
+		cube_visual const visual = create_cube_visual(cube);
+		visual.set_transform(cube.position, Quaternion{s.rotation[3], s.rotation[0], s.rotation[1], s.rotation[2]});
+		uint32_t const cube_id = _cubes.add(cube.position, cube.scale, bodies[i], visual);
+		visual.set_visible(cube_id < cube_count);  // pooled bodies are not simulated (saved out of world)
+	}
+
+	_active_cubes = cube_count;
+
+	_cube_count = static_cast<int>(cube_count);
+	cout << "scene loaded from '" << path << "' (" << cube_count << " cubes, " << body_count - cube_count
+		<< " pooled)" << endl;
+	return true;
+}
+
+cube_visual cube_rain::create_cube_visual(cube_object const & cube)
+{
+	assert(_scene);
+	if (_instanced)
+		return cube_visual{nullptr, nullptr, create_cube_instance(cube)};
+	else
+		return create_cube_node(*_scene, cube);
+}
+
+cube_visual cube_rain::create_cube_node(SceneManager & scene, cube_object const & cube)
 {
 	Entity * cube_model = scene.createEntity(SceneManager::PT_CUBE);
 	cube_model->setMaterialName("cube_color");  // see media/cube.material
 
+	SubEntity * model = cube_model->getSubEntity(0);
+	model->setCustomParameter(0, no_impact);
+
 	SceneNode * nd = scene.getRootSceneNode()->createChildSceneNode(cube.position);
 	Real model_scale = 0.2 * (2.0 / cube_model->getBoundingBox().getSize().x);
 	Real cube_scale = model_scale * cube.scale;
 	nd->setScale(cube_scale, cube_scale, cube_scale);
 	nd->attachObject(cube_model);
 
-	return nd;
+	return cube_visual{nd, model, nullptr};
 }
 
-physics::body * cube_rain::create_cube_body(cube_object const & cube, SceneNode * nd)
+InstancedEntity * cube_rain::create_cube_instance(cube_object const & cube)
+{
+	assert(_cube_instances);
+	InstancedEntity * instance = _scene->createInstancedEntity("cube_instanced_color", "cubes");  // see media/cube.material
+	instance->setCustomParam(0, no_impact);
+
+	Real model_scale = 0.2 * (2.0 / instance->getBoundingBox().getSize().x);
+	instance->setScale(Vector3{model_scale * cube.scale}, false);
+	instance->setPosition(cube.position);
+
+	return instance;
+}
+
+physics::body_handle cube_rain::create_cube_body(cube_object const & cube)
 {
 	btScalar mass = 1;
-	physics::body * result = new physics::body{
-		make_unique<btBoxShape>(btVector3{.5, .5, .5} * cube.scale),
+	physics::body_handle result = _world.create_body(
+		_world.shapes().box(btVector3{.5, .5, .5} * cube.scale),  // cubes with the same scale share shape
 		physics::translate(to_bullet(cube.position)),
-		mass
-	};
+		mass);
+
+	physics::body & body = _world.get(result);
+	body.rigid_body().setLinearVelocity(fall_velocity(cube));
+
+	body.rigid_body().setUserIndex(pooled_cube);  // dense cube id into _cubes once active
 
-	btScalar const fall_speed = 3 * (2.0 - cube.scale);
-	result->rigid_body().setLinearVelocity(btVector3{0, -fall_speed, 0});
+	return result;  // body is added to simulation by activate_cubes()
+}
 
-	result->rigid_body().setUserPointer(nd);  // link with OGRE
+void cube_visual::set_transform(Vector3 const & position, Quaternion const & orientation)
+{
+	if (instance)
+	{
+		instance->setPosition(position, false);
+		instance->setOrientation(orientation);  // updates instance transform
+	}
+	else
+	{
+		node->setPosition(position);
+		node->setOrientation(orientation);
+	}
+}
 
-	_world.add_body(result);
+void cube_visual::set_visible(bool visible)
+{
+	if (instance)
+		instance->setVisible(visible);
+	else
+		node->setVisible(visible);  // cascades to cube model
+}
 
+btVector3 fall_velocity(cube_object const & cube)
+{
+	btScalar const fall_speed = 3 * (2.0 - cube.scale);  // smaller cubes fall faster
+	return btVector3{0, -fall_speed, 0};
+}
+
+//! \param scheduler shared with the app, so queries do not create own threads
+physics::world_options make_world_options(cube_rain_options const & opts, btITaskScheduler * scheduler)
+{
+	physics::world_options result;
+	result.scheduler = scheduler;
+	result.particles.enabled = opts.particles;
+	result.particles.focus = to_bullet(camera_position);
+	result.particles.focus_radius = 30;
 	return result;
 }
 
@@ -459,11 +1016,15 @@ btTransform translate(Vector3 const & v)
 	return T;
 }
 
-cube_object new_cube()
+//! random engine of the calling thread, see cube_rain::sync_cubes()
+default_random_engine & thread_random_engine()
 {
-	static random_device rd;
-	static default_random_engine rand{rd()};
+	thread_local default_random_engine rand{random_device{}()};
+	return rand;
+}
 
+cube_object new_cube(default_random_engine & rand)
+{
 	// generate three grid cube indices for 10x10x10 grid cube
 	constexpr unsigned size = 10;
 	unsigned i = rand() % size,
@@ -497,7 +1058,33 @@ string to_string(CameraStyle style)
 
 int main(int argc, char * argv[])
 {
-	cube_rain app;
+	cube_rain_options opts;
+	for (int i = 1; i < argc; ++i)
+	{
+		string const arg = argv[i];
+		if (arg == "--instanced")
+			opts.instanced = true;
+		else if (arg == "--particles")
+			opts.particles = true;
+		else if (arg == "--record" && i+1 < argc)
+			opts.record_path = argv[++i];
+		else if (arg == "--replay" && i+1 < argc)
+			opts.replay_path = argv[++i];
+		else if (arg == "--scene" && i+1 < argc)
+			opts.scene_path = argv[++i];
+		else
+		{
+			cout << "usage: cube_rain [--instanced] [--particles] [--record FILE] [--replay FILE] [--scene FILE]\n"
+				<< "  --instanced  render cubes with hardware instancing (up to 50000 cubes)\n"
+				<< "  --particles  simulate cubes far from camera or from other cubes as particles (up to 150000 instanced cubes)\n"
+				<< "  --record     write physics trace (body transforms, collisions) of the run into FILE\n"
+				<< "  --replay     play physics trace from FILE instead of simulation\n"
+				<< "  --scene      pre-settled scene file, loaded at start and written by Save scene button (default cube_rain.scene)\n";
+			return 1;
+		}
+	}
+
+	cube_rain app{opts};
 	app.go();
 	return 0;
 }
@@ -0,0 +1,122 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <OGRE/OgreVector.h>
+#include <OGRE/OgreQuaternion.h>
+#include "slab_pool.hpp"
+
+namespace Ogre {
+
+class SceneNode;
+class SubEntity;
+class InstancedEntity;
+
+}  // Ogre
+
+// cube scene representation, either scene node with entity or hardware instanced entity (see --instanced)
+struct cube_visual
+{
+	Ogre::SceneNode * node = nullptr;
+	Ogre::SubEntity * model = nullptr;  // node's cube model
+	Ogre::InstancedEntity * instance = nullptr;
+
+	void set_transform(Ogre::Vector3 const & position, Ogre::Quaternion const & orientation);
+	void set_visible(bool visible);
+};
+
+/*! Dense SoA store of cube components (position, scale, body, visual and highlight time).
+
+Cubes are identified by dense ids in [0, size()) range and each component is stored in its own
+contiguous column indexed by id. Any cube is removed in O(1) by moving the last cube into its place
+(swap-remove), so the moved cube changes its id and everything keyed by the id (e.g. body user index)
+needs to be updated by the caller.
+\code
+cube_store cubes;
+uint32_t const id = cubes.add(position, scale, body, visual);
+uint32_t const moved = cubes.remove(id);  // cube `moved` has now `id`
+\endcode */
+class cube_store
+{
+public:
+	static constexpr double no_highlight = -1;
+
+	//! \return id of the new cube (size() - 1)
+	uint32_t add(Ogre::Vector3 const & position, Ogre::Real scale, physics::slab_handle body,
+		cube_visual const & visual);
+
+	//! \return previous id of the cube moved into `id` place (`id` if the last cube was removed)
+	uint32_t remove(uint32_t id);
+	void swap(uint32_t a, uint32_t b);  //!< exchanges ids of cubes `a` and `b`
+	void reserve(size_t n);
+	size_t size() const {return _positions.size();}
+	bool empty() const {return _positions.empty();}
+
+	// columns
+	Ogre::Vector3 & position(uint32_t id) {return _positions[id];}
+	Ogre::Real & scale(uint32_t id) {return _scales[id];}
+	physics::slab_handle body(uint32_t id) const {return _bodies[id];}
+	cube_visual const & visual(uint32_t id) const {return _visuals[id];}
+	double & highlight_end(uint32_t id) {return _highlight_ends[id];}  //!< highlight expiry time or no_highlight
+
+	std::vector<physics::slab_handle> const & bodies() const {return _bodies;}  //!< body handles indexed by id
+
+private:
+	std::vector<Ogre::Vector3> _positions;
+	std::vector<Ogre::Real> _scales;  // value between 0.7 and 1.4 used to scale cube model
+	std::vector<physics::slab_handle> _bodies;  // bodies are stored in physics::world
+	std::vector<cube_visual> _visuals;
+	std::vector<double> _highlight_ends;
+};
+
+inline uint32_t cube_store::add(Ogre::Vector3 const & position, Ogre::Real scale, physics::slab_handle body,
+	cube_visual const & visual)
+{
+	_positions.push_back(position);
+	_scales.push_back(scale);
+	_bodies.push_back(body);
+	_visuals.push_back(visual);
+	_highlight_ends.push_back(no_highlight);
+	return static_cast<uint32_t>(size() - 1);
+}
+
+inline uint32_t cube_store::remove(uint32_t id)
+{
+	assert(id < size());
+	uint32_t const last = static_cast<uint32_t>(size() - 1);
+
+	_positions[id] = _positions[last];
+	_scales[id] = _scales[last];
+	_bodies[id] = _bodies[last];
+	_visuals[id] = _visuals[last];
+	_highlight_ends[id] = _highlight_ends[last];
+
+	_positions.pop_back();
+	_scales.pop_back();
+	_bodies.pop_back();
+	_visuals.pop_back();
+	_highlight_ends.pop_back();
+
+	return last;
+}
+
+inline void cube_store::swap(uint32_t a, uint32_t b)
+{
+	assert(a < size() && b < size());
+	std::swap(_positions[a], _positions[b]);
+	std::swap(_scales[a], _scales[b]);
+	std::swap(_bodies[a], _bodies[b]);
+	std::swap(_visuals[a], _visuals[b]);
+	std::swap(_highlight_ends[a], _highlight_ends[b]);
+}
+
+inline void cube_store::reserve(size_t n)
+{
+	_positions.reserve(n);
+	_scales.reserve(n);
+	_bodies.reserve(n);
+	_visuals.reserve(n);
+	_highlight_ends.reserve(n);
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include "grid_broadphase.hpp"
+#include "profiler.hpp"
+
+using std::vector, std::size, std::max;
+using std::make_unique;
+using std::cout, std::endl;
+
+namespace physics {
+
+static bool overlap(btScalar const * min_a, btScalar const * max_a, btScalar const * min_b,
+	btScalar const * max_b)
+{
+	return min_a[0] <= max_b[0] && max_a[0] >= min_b[0]
+		&& min_a[1] <= max_b[1] && max_a[1] >= min_b[1]
+		&& min_a[2] <= max_b[2] && max_a[2] >= min_b[2];
+}
+
+//! removes pairs which AABBs do not overlap anymore
+struct stale_pairs_remover : public btOverlapCallback
+{
+	bool processOverlap(btBroadphasePair & pair) override
+	{
+		return !TestAabbAgainstAabb2(pair.m_pProxy0->m_aabbMin, pair.m_pProxy0->m_aabbMax,
+			pair.m_pProxy1->m_aabbMin, pair.m_pProxy1->m_aabbMax);
+	}
+};
+
+grid_broadphase::grid_broadphase(btScalar cell_size, btOverlappingPairCache * pair_cache)
+	: _cell_size{cell_size}
+	, _pair_cache{pair_cache}
+{
+	assert(cell_size > 0);
+	if (!_pair_cache)
+	{
+		_own_pair_cache = make_unique<btHashedOverlappingPairCache>();
+		_pair_cache = _own_pair_cache.get();
+	}
+}
+
+btOverlappingPairCache * grid_broadphase::set_pair_cache(btOverlappingPairCache * pair_cache)
+{
+	btOverlappingPairCache * prev = _pair_cache;
+	_pair_cache = pair_cache;
+	return prev;
+}
+
+btBroadphaseProxy * grid_broadphase::createProxy(btVector3 const & aabb_min, btVector3 const & aabb_max,
+	int shape_type, void * user_ptr, int filter_group, int filter_mask, btDispatcher * dispatcher)
+{
+	assert(user_ptr && "collision object expected");
+
+	uint32_t idx;
+	if (!_free_proxies.empty())
+	{
+		idx = _free_proxies.back();
+		_free_proxies.pop_back();
+	}
+	else
+	{
+		idx = static_cast<uint32_t>(size(_proxies));
+		_proxies.emplace_back();
+		_large.push_back(0);
+	}
+
+	btBroadphaseProxy & p = _proxies[idx];
+	p.m_clientObject = user_ptr;
+	p.m_collisionFilterGroup = filter_group;
+	p.m_collisionFilterMask = filter_mask;
+	p.m_aabbMin = aabb_min;
+	p.m_aabbMax = aabb_max;
+	p.m_uniqueId = static_cast<int>(idx + 1);
+
+	++_proxy_count;
+	return &p;  // pairs are found by the next calculateOverlappingPairs() call
+}
+
+void grid_broadphase::destroyProxy(btBroadphaseProxy * proxy, btDispatcher * dispatcher)
+{
+	_pair_cache->removeOverlappingPairsContainingProxy(proxy, dispatcher);
+
+	uint32_t const idx = static_cast<uint32_t>(proxy->m_uniqueId - 1);
+	assert(&_proxies[idx] == proxy);
+	proxy->m_clientObject = nullptr;
+	_free_proxies.push_back(idx);
+	--_proxy_count;
+}
+
+void grid_broadphase::setAabb(btBroadphaseProxy * proxy, btVector3 const & aabb_min, btVector3 const & aabb_max,
+	btDispatcher * dispatcher)
+{
+	proxy->m_aabbMin = aabb_min;
+	proxy->m_aabbMax = aabb_max;
+}
+
+void grid_broadphase::getAabb(btBroadphaseProxy * proxy, btVector3 & aabb_min, btVector3 & aabb_max) const
+{
+	aabb_min = proxy->m_aabbMin;
+	aabb_max = proxy->m_aabbMax;
+}
+
+void grid_broadphase::rayTest(btVector3 const & ray_from, btVector3 const & ray_to,
+	btBroadphaseRayCallback & callback, btVector3 const & aabb_min, btVector3 const & aabb_max)
+{
+	for (btBroadphaseProxy & p : _proxies)
+	{
+		if (!p.m_clientObject)
+			continue;
+
+		// proxy AABB grown by swept AABB (zero for rays)
+		btVector3 const bounds[2] = {p.m_aabbMin - aabb_max, p.m_aabbMax - aabb_min};
+		btScalar t = 0;
+		if (btRayAabb2(ray_from, callback.m_rayDirectionInverse, callback.m_signs, bounds, t, 0,
+			callback.m_lambda_max))
+		{
+			callback.process(&p);
+		}
+	}
+}
+
+void grid_broadphase::aabbTest(btVector3 const & aabb_min, btVector3 const & aabb_max,
+	btBroadphaseAabbCallback & callback)
+{
+	for (btBroadphaseProxy & p : _proxies)
+	{
+		if (p.m_clientObject && TestAabbAgainstAabb2(aabb_min, aabb_max, p.m_aabbMin, p.m_aabbMax))
+			callback.process(&p);
+	}
+}
+
+void grid_broadphase::calculateOverlappingPairs(btDispatcher * dispatcher)
+{
+	PHYSICS_PROFILE_SCOPE("grid_broadphase");
+	remove_stale_pairs(dispatcher);
+	build_grid();
+	find_bucket_pairs(dispatcher);
+	find_large_proxy_pairs(dispatcher);
+}
+
+void grid_broadphase::getBroadphaseAabb(btVector3 & aabb_min, btVector3 & aabb_max) const
+{
+	aabb_min = aabb_max = btVector3{0, 0, 0};
+	bool first = true;
+	for (btBroadphaseProxy const & p : _proxies)
+	{
+		if (!p.m_clientObject)
+			continue;
+
+		if (first)
+		{
+			aabb_min = p.m_aabbMin;
+			aabb_max = p.m_aabbMax;
+			first = false;
+		}
+		else
+		{
+			aabb_min.setMin(p.m_aabbMin);
+			aabb_max.setMax(p.m_aabbMax);
+		}
+	}
+}
+
+void grid_broadphase::printStats()
+{
+	cout << "grid_broadphase: " << _proxy_count << " proxies, " << size(_entries) << " cell entries, "
+		<< size(_large_proxies) << " large proxies, cell size " << _cell_size << endl;
+}
+
+//! one pass over all pairs, cheaper than tracking pairs of moved proxies
+void grid_broadphase::remove_stale_pairs(btDispatcher * dispatcher)
+{
+	stale_pairs_remover remover;
+	_pair_cache->processAllOverlappingPairs(&remover, dispatcher);
+}
+
+void grid_broadphase::build_grid()
+{
+	_hash.reset(_cell_size, _proxy_count);
+	_large_proxies.clear();
+	for (uint32_t idx = 0; idx < size(_proxies); ++idx)
+	{
+		if (!alive(idx))
+			continue;
+
+		btBroadphaseProxy const & p = _proxies[idx];
+		_large[idx] = !_hash.insert(idx, p.m_aabbMin, p.m_aabbMax, max_proxy_cells);
+		if (_large[idx])
+			_large_proxies.push_back(idx);
+	}
+
+	_hash.sort();
+
+	vector<uint32_t> const & proxies = _hash.items();
+	_entries.resize(size(proxies));
+	for (size_t i = 0; i < size(proxies); ++i)
+	{
+		btBroadphaseProxy const & p = _proxies[proxies[i]];
+		cell_entry & e = _entries[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			e.min[k] = p.m_aabbMin[k];
+			e.max[k] = p.m_aabbMax[k];
+		}
+		e.proxy = proxies[i];
+	}
+}
+
+void grid_broadphase::find_bucket_pairs(btDispatcher * dispatcher)
+{
+	for (uint32_t b = 0; b < _hash.bucket_count(); ++b)
+	{
+		uint32_t const first = _hash.bucket_begin(b),
+			last = _hash.bucket_end(b);
+
+		for (uint32_t i = first; i < last; ++i)
+		{
+			cell_entry const & e0 = _entries[i];
+			for (uint32_t j = i + 1; j < last; ++j)
+			{
+				cell_entry const & e1 = _entries[j];
+				if (!overlap(e0.min, e0.max, e1.min, e1.max))
+					continue;
+
+				// both proxies covers home cell, so the pair is reported only once
+				btScalar const home[3] = {max(e0.min[0], e1.min[0]), max(e0.min[1], e1.min[1]),
+					max(e0.min[2], e1.min[2])};
+				if (_hash.bucket_of(_hash.cell_of(home)) != b)
+					continue;
+
+				_pair_cache->addOverlappingPair(&_proxies[e0.proxy], &_proxies[e1.proxy]);  // existing pair is kept
+			}
+		}
+	}
+}
+
+void grid_broadphase::find_large_proxy_pairs(btDispatcher * dispatcher)
+{
+	for (uint32_t large_idx : _large_proxies)
+	{
+		btBroadphaseProxy & large = _proxies[large_idx];
+		for (uint32_t idx = 0; idx < size(_proxies); ++idx)
+		{
+			if (idx == large_idx || !alive(idx) || (_large[idx] && idx < large_idx))  // large pairs only once
+				continue;
+
+			btBroadphaseProxy & p = _proxies[idx];
+			if (TestAabbAgainstAabb2(large.m_aabbMin, large.m_aabbMax, p.m_aabbMin, p.m_aabbMax))
+				_pair_cache->addOverlappingPair(&large, &p);
+		}
+	}
+}
+
+}  // physics
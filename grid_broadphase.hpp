@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <bullet/BulletCollision/btBulletCollisionCommon.h>
+#include "spatial_hash.hpp"
+
+namespace physics {
+
+/*! Uniform grid (spatial hash) broadphase for many similarly sized bodies.
+
+Grid is rebuilt from scratch in every calculateOverlappingPairs() call: each proxy is hashed into
+the cells its AABB touches and cell buckets are laid out contiguously (counting sort), so candidate
+pairs are tested from one dense array and there is no tree to rebalance. A pair is reported only
+from its home cell (the cell of the maximum of both AABB minimums), so pairs sharing more cells are
+reported once. Proxies touching more than `max_proxy_cells` cells (e.g. ground) are tested against
+all proxies instead.
+\code
+grid_broadphase broadphase{2.5};  // cell size should be about the biggest body AABB size
+btDiscreteDynamicsWorld world{&dispatcher, &broadphase, &solver, &config};
+\endcode
+\note rayTest() and aabbTest() visit all proxies (AABB test only) */
+class grid_broadphase : public btBroadphaseInterface
+{
+public:
+	static constexpr size_t max_proxy_cells = 8;
+
+	//! \param pair_cache overlapping pair cache, btHashedOverlappingPairCache owned by broadphase for nullptr
+	explicit grid_broadphase(btScalar cell_size, btOverlappingPairCache * pair_cache = nullptr);
+	grid_broadphase(grid_broadphase const &) = delete;
+	grid_broadphase & operator=(grid_broadphase const &) = delete;
+
+	//! replaces overlapping pair cache (not owned), \return previous pair cache
+	btOverlappingPairCache * set_pair_cache(btOverlappingPairCache * pair_cache);
+	size_t proxy_count() const {return _proxy_count;}
+
+	// btBroadphaseInterface
+	btBroadphaseProxy * createProxy(btVector3 const & aabb_min, btVector3 const & aabb_max, int shape_type,
+		void * user_ptr, int filter_group, int filter_mask, btDispatcher * dispatcher) override;
+	void destroyProxy(btBroadphaseProxy * proxy, btDispatcher * dispatcher) override;
+	void setAabb(btBroadphaseProxy * proxy, btVector3 const & aabb_min, btVector3 const & aabb_max,
+		btDispatcher * dispatcher) override;
+	void getAabb(btBroadphaseProxy * proxy, btVector3 & aabb_min, btVector3 & aabb_max) const override;
+	void rayTest(btVector3 const & ray_from, btVector3 const & ray_to, btBroadphaseRayCallback & callback,
+		btVector3 const & aabb_min = btVector3{0, 0, 0}, btVector3 const & aabb_max = btVector3{0, 0, 0}) override;
+	void aabbTest(btVector3 const & aabb_min, btVector3 const & aabb_max, btBroadphaseAabbCallback & callback) override;
+	void calculateOverlappingPairs(btDispatcher * dispatcher) override;
+	btOverlappingPairCache * getOverlappingPairCache() override {return _pair_cache;}
+	btOverlappingPairCache const * getOverlappingPairCache() const override {return _pair_cache;}
+	void getBroadphaseAabb(btVector3 & aabb_min, btVector3 & aabb_max) const override;
+	void printStats() override;
+
+private:
+	struct cell_entry
+	{
+		btScalar min[3], max[3];  // proxy AABB copy, bucket pairs are tested without touching proxies
+		uint32_t proxy;
+	};
+
+	void remove_stale_pairs(btDispatcher * dispatcher);
+	void build_grid();
+	void find_bucket_pairs(btDispatcher * dispatcher);
+	void find_large_proxy_pairs(btDispatcher * dispatcher);
+	bool alive(uint32_t idx) const {return _proxies[idx].m_clientObject != nullptr;}
+
+	btScalar const _cell_size;
+	std::unique_ptr<btOverlappingPairCache> _own_pair_cache;
+	btOverlappingPairCache * _pair_cache;
+
+	std::deque<btBroadphaseProxy> _proxies;  // stable addresses, index is m_uniqueId - 1
+	std::vector<uint32_t> _free_proxies;
+	size_t _proxy_count = 0;
+
+	// grid, rebuilt every calculateOverlappingPairs() call (buffers are reused)
+	spatial_hash _hash;
+	std::vector<cell_entry> _entries;  // in _hash.items() order
+	std::vector<uint32_t> _large_proxies;
+	std::vector<uint8_t> _large;  // per proxy flag
+};
+
+}  // physics
@@ -0,0 +1,10 @@
+#version 150
+
+in vec4 colour;
+
+out vec4 fragColour;
+
+void main()
+{
+	fragColour = vec4(colour.rgb, 1.0);
+}
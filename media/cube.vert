@@ -0,0 +1,50 @@
+#version 150
+
+// cube vertex shader with per-vertex lighting (one light) and collision highlight fading out
+// after impact, INSTANCED for hardware instancing (HWInstancingBasic)
+
+in vec4 vertex;
+in vec3 normal;
+
+#ifdef INSTANCED
+in vec4 uv1;  // instance world matrix rows (3x4)
+in vec4 uv2;
+in vec4 uv3;
+in vec4 uv4;  // instance custom parameter, x is impact time
+#else
+uniform mat4 worldMatrix;
+uniform vec4 impact;  // x is impact time
+#endif
+
+uniform mat4 viewProjMatrix;
+uniform vec4 lightPosition;  // in world space
+uniform vec4 lightDiffuse;
+uniform vec4 ambientLight;
+uniform vec4 surfaceAmbient;
+uniform vec4 surfaceDiffuse;
+uniform float time;  // the same clock as impact time
+uniform vec4 highlightColour;
+uniform float highlightDuration;
+
+out vec4 colour;
+
+void main()
+{
+#ifdef INSTANCED
+	vec4 worldPos = vec4(dot(uv1, vertex), dot(uv2, vertex), dot(uv3, vertex), 1.0);
+	vec3 worldNormal = normalize(vec3(dot(uv1.xyz, normal), dot(uv2.xyz, normal), dot(uv3.xyz, normal)));
+	float impactTime = uv4.x;
+#else
+	vec4 worldPos = worldMatrix * vertex;
+	vec3 worldNormal = normalize(mat3(worldMatrix) * normal);
+	float impactTime = impact.x;
+#endif
+
+	float highlight = 1.0 - clamp((time - impactTime) / highlightDuration, 0.0, 1.0);
+	vec4 ambient = mix(surfaceAmbient, highlightColour, highlight);
+	vec4 diffuse = mix(surfaceDiffuse, highlightColour, highlight);
+
+	vec3 lightDir = normalize(lightPosition.xyz - worldPos.xyz * lightPosition.w);
+	colour = ambientLight * ambient + lightDiffuse * diffuse * max(dot(worldNormal, lightDir), 0.0);
+	gl_Position = viewProjMatrix * worldPos;
+}
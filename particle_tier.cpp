@@ -0,0 +1,335 @@
+// particle tier and world tier assignment implementation
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(BT_USE_DOUBLE_PRECISION)
+	#include <emmintrin.h>
+	#define PARTICLE_TIER_SSE
+#endif
+#include "physics.hpp"
+
+using std::vector, std::size;
+
+namespace physics {
+
+void particle_tier::add(slab_handle h, btVector3 const & position, btVector3 const & velocity, btScalar radius)
+{
+	assert(!contains(h));
+
+	if (h.index >= _index.size())
+		_index.resize(h.index + 1, no_particle);
+	_index[h.index] = static_cast<uint32_t>(_handles.size());
+
+	for (int k = 0; k < 3; ++k)
+	{
+		_position[k].push_back(position[k]);
+		_velocity[k].push_back(velocity[k]);
+	}
+	_radius.push_back(radius);
+	_handles.push_back(h);
+}
+
+void particle_tier::remove(slab_handle h)
+{
+	uint32_t const idx = find(h);
+	assert(idx != no_particle);
+
+	uint32_t const last = static_cast<uint32_t>(_handles.size() - 1);
+	for (int k = 0; k < 3; ++k)
+	{
+		_position[k][idx] = _position[k][last];
+		_velocity[k][idx] = _velocity[k][last];
+		_position[k].pop_back();
+		_velocity[k].pop_back();
+	}
+	_radius[idx] = _radius[last];
+	_radius.pop_back();
+	_handles[idx] = _handles[last];
+	_handles.pop_back();
+
+	_index[h.index] = no_particle;
+	if (idx != last)
+		_index[_handles[idx].index] = idx;
+}
+
+void particle_tier::clear()
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		_position[k].clear();
+		_velocity[k].clear();
+	}
+	_radius.clear();
+	_handles.clear();
+	_index.clear();
+}
+
+uint32_t particle_tier::find(slab_handle h) const
+{
+	if (h.index >= _index.size())
+		return no_particle;
+
+	uint32_t const idx = _index[h.index];
+	return (idx != no_particle && _handles[idx] == h) ? idx : no_particle;
+}
+
+//! velocity first, then position (semi-implicit Euler as btRigidBody)
+void particle_tier::integrate(btScalar dt, btVector3 const & gravity)
+{
+	PHYSICS_PROFILE_SCOPE("integrate_particles");
+
+	size_t const n = _handles.size();
+	for (int k = 0; k < 3; ++k)
+	{
+		btScalar * p = _position[k].data(),
+			* v = _velocity[k].data();
+		btScalar const dv = gravity[k] * dt;
+
+		size_t i = 0;
+#ifdef PARTICLE_TIER_SSE
+		__m128 const dt4 = _mm_set1_ps(dt),
+			dv4 = _mm_set1_ps(dv);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 const vel = _mm_add_ps(_mm_loadu_ps(v + i), dv4);
+			_mm_storeu_ps(v + i, vel);
+			_mm_storeu_ps(p + i, _mm_add_ps(_mm_loadu_ps(p + i), _mm_mul_ps(vel, dt4)));
+		}
+#endif
+		for (; i < n; ++i)  // the rest
+		{
+			v[i] += dv;
+			p[i] += v[i] * dt;
+		}
+	}
+}
+
+void particle_tier::set(uint32_t idx, btVector3 const & position, btVector3 const & velocity)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		_position[k][idx] = position[k];
+		_velocity[k][idx] = velocity[k];
+	}
+}
+
+btVector3 particle_tier::position(uint32_t idx) const
+{
+	return btVector3{_position[0][idx], _position[1][idx], _position[2][idx]};
+}
+
+btVector3 particle_tier::velocity(uint32_t idx) const
+{
+	return btVector3{_velocity[0][idx], _velocity[1][idx], _velocity[2][idx]};
+}
+
+void proximity_grid::add(btVector3 const & min, btVector3 const & max)
+{
+	_boxes.push_back(box{{min.x(), min.y(), min.z()}, {max.x(), max.y(), max.z()}});
+}
+
+static bool overlap(btScalar const * min_a, btScalar const * max_a, btScalar const * min_b,
+	btScalar const * max_b)
+{
+	return min_a[0] <= max_b[0] && max_a[0] >= min_b[0]
+		&& min_a[1] <= max_b[1] && max_a[1] >= min_b[1]
+		&& min_a[2] <= max_b[2] && max_a[2] >= min_b[2];
+}
+
+void proximity_grid::find_near(btScalar cell_size, std::vector<uint8_t> & near)
+{
+	PHYSICS_PROFILE_SCOPE("proximity_grid");
+
+	uint32_t const box_count = static_cast<uint32_t>(_boxes.size());
+	near.assign(box_count, 0);
+
+	_hash.reset(cell_size, box_count);
+	_large.clear();
+	for (uint32_t idx = 0; idx < box_count; ++idx)
+	{
+		if (!_hash.insert(idx, _boxes[idx].min, _boxes[idx].max, max_box_cells))
+			_large.push_back(idx);
+	}
+	_hash.sort();
+
+	// the same pair can be tested from more buckets, marking is idempotent
+	vector<uint32_t> const & boxes = _hash.items();
+	for (uint32_t b = 0; b < _hash.bucket_count(); ++b)
+	{
+		uint32_t const first = _hash.bucket_begin(b),
+			last = _hash.bucket_end(b);
+
+		for (uint32_t i = first; i < last; ++i)
+		{
+			uint32_t const a = boxes[i];
+			for (uint32_t j = i + 1; j < last; ++j)
+			{
+				uint32_t const c = boxes[j];
+				if ((near[a] && near[c]) || !overlap(_boxes[a].min, _boxes[a].max, _boxes[c].min, _boxes[c].max))
+					continue;
+
+				near[a] = near[c] = 1;
+			}
+		}
+	}
+
+	for (uint32_t large : _large)
+	{
+		for (uint32_t idx = 0; idx < box_count; ++idx)
+		{
+			if (idx != large && overlap(_boxes[large].min, _boxes[large].max, _boxes[idx].min, _boxes[idx].max))
+				near[large] = near[idx] = 1;
+		}
+	}
+}
+
+void world::step_particles(btScalar dt)
+{
+	if (!_particle_opts.enabled)
+		return;
+
+	_particles.integrate(dt, _world->getGravity());
+	update_tiers(dt);
+
+	// particle bodies follow particles (queries test body shape at body transform)
+	for (uint32_t idx = 0; idx < _particles.size(); ++idx)
+		get(_particles.handle(idx)).rigid_body().getWorldTransform().setOrigin(_particles.position(idx));
+
+	PHYSICS_PROFILE_COUNTER("particles", _particles.size());
+}
+
+void world::update_tiers(btScalar step)
+{
+	if (++_tier_steps < _particle_opts.update_interval)
+		return;
+
+	PHYSICS_PROFILE_SCOPE("update_tiers");
+
+	_tier_steps = 0;
+
+	// AABBs are grown by the distance body can travel till the next update
+	btScalar const horizon = _particle_opts.update_interval * step,
+		fall = btScalar(0.5) * _world->getGravity().length() * horizon * horizon,
+		margin = _particle_opts.margin;
+
+	btCollisionObjectArray & colls = _world->getCollisionObjectArray();
+	if (size(_batch_marks) < size(colls))  // world owned bodies in Bullet, see mark_bodies()
+		_batch_marks.resize(size(colls), 0);
+	_proximity.clear();
+	_proximity_bodies.clear();
+
+	_bodies.for_each([&](body_handle h, body & b){
+		btRigidBody & rb = b.rigid_body();
+
+		uint32_t const idx = _particles.find(h);
+		if (idx != particle_tier::no_particle)
+		{
+			btVector3 const p = _particles.position(idx);
+			btScalar const reach = _particles.radius(idx) + _particles.velocity(idx).length() * horizon + fall + margin;
+			_proximity.add(p - btVector3{reach, reach, reach}, p + btVector3{reach, reach, reach});
+			_proximity_bodies.push_back(h);
+			return;
+		}
+
+		if (!rb.isInWorld())
+			return;
+
+		_batch_marks[rb.getWorldArrayIndex()] = 1;
+		_batch_marked.push_back(rb.getWorldArrayIndex());
+
+		bool const dynamic = !rb.isStaticOrKinematicObject();
+		btScalar const reach = rb.getLinearVelocity().length() * horizon + (dynamic ? fall : 0) + margin;
+		btBroadphaseProxy const * proxy = rb.getBroadphaseHandle();
+		_proximity.add(proxy->m_aabbMin - btVector3{reach, reach, reach}, proxy->m_aabbMax + btVector3{reach, reach, reach});
+		_proximity_bodies.push_back((dynamic && rb.isActive()) ? h : body_handle{});  // others stays in Bullet
+	});
+
+	// bodies not owned by world
+	for (int i = 0; i < size(colls); ++i)
+	{
+		if (_batch_marks[i] || !colls[i]->getBroadphaseHandle())
+			continue;
+
+		btRigidBody const * rb = btRigidBody::upcast(colls[i]);
+		bool const dynamic = rb && !rb->isStaticOrKinematicObject();
+		btScalar const reach = (rb ? rb->getLinearVelocity().length() * horizon : 0) + (dynamic ? fall : 0) + margin;
+		btBroadphaseProxy const * proxy = colls[i]->getBroadphaseHandle();
+		_proximity.add(proxy->m_aabbMin - btVector3{reach, reach, reach}, proxy->m_aabbMax + btVector3{reach, reach, reach});
+		_proximity_bodies.push_back(body_handle{});
+	}
+	unmark_bodies();
+
+	_proximity.find_near(_particle_opts.cell_size, _near);
+
+	_promoted.clear();
+	_demoted.clear();
+	btScalar const focus_radius2 = _particle_opts.focus_radius * _particle_opts.focus_radius;
+	for (size_t i = 0; i < size(_proximity_bodies); ++i)
+	{
+		body_handle const h = _proximity_bodies[i];
+		if (!h)
+			continue;
+
+		uint32_t const idx = _particles.find(h);
+		bool const particle = idx != particle_tier::no_particle;
+		btVector3 const p = particle ? _particles.position(idx) : get(h).position();
+
+		// bodies close to others are always simulated by Bullet, focus only keeps bodies around it rigid
+		bool const want_particle = !_near[i] && (p - _particle_opts.focus).length2() > focus_radius2;
+		if (want_particle != particle)
+			(particle ? _promoted : _demoted).push_back(h);
+	}
+
+	promote(handle_range{_promoted.data(), _promoted.data() + size(_promoted)});
+	demote(handle_range{_demoted.data(), _demoted.data() + size(_demoted)});
+
+	PHYSICS_PROFILE_COUNTER("promoted bodies", size(_promoted));
+	PHYSICS_PROFILE_COUNTER("demoted bodies", size(_demoted));
+}
+
+void world::promote(handle_range bodies)
+{
+	if (bodies.empty())
+		return;
+
+	for (body_handle h : bodies)
+	{
+		uint32_t const idx = _particles.find(h);
+		btRigidBody & rb = get(h).rigid_body();
+
+		btTransform T = rb.getWorldTransform();  // particles do not rotate
+		T.setOrigin(_particles.position(idx));
+		rb.setWorldTransform(T);
+		rb.setInterpolationWorldTransform(T);
+		if (rb.getMotionState())
+			rb.getMotionState()->setWorldTransform(T);
+
+		btVector3 const v = _particles.velocity(idx);
+		rb.setLinearVelocity(v);
+		rb.setInterpolationLinearVelocity(v);
+		rb.activate(true);
+
+		_particles.remove(h);
+	}
+
+	add_bodies(bodies);
+}
+
+void world::demote(handle_range bodies)
+{
+	if (bodies.empty())
+		return;
+
+	remove_bodies(bodies);  // one pass over pairs
+
+	for (body_handle h : bodies)
+	{
+		btRigidBody const & rb = get(h).rigid_body();
+		btVector3 center;
+		btScalar radius;
+		rb.getCollisionShape()->getBoundingSphere(center, radius);
+		_particles.add(h, rb.getWorldTransform().getOrigin(), rb.getLinearVelocity(), radius);
+	}
+}
+
+}  // physics
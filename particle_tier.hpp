@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <bullet/BulletCollision/btBulletCollisionCommon.h>
+#include "slab_pool.hpp"
+#include "spatial_hash.hpp"
+
+namespace physics {
+
+/*! Bodies simulated outside of Bullet as kinematic particles (position and velocity only).
+
+Particle state is stored as SoA arrays and integrated with SSE four particles at once (the same
+semi-implicit Euler as Bullet uses, without damping and rotation). Particles do not collide,
+see world_options::particles for how bodies are moved between Bullet and particle tier.
+\code
+particle_tier particles;
+particles.add(h, position, velocity, radius);
+particles.integrate(1.0/60.0, btVector3{0, -9.81, 0});
+btVector3 const p = particles.position(particles.find(h));
+\endcode */
+class particle_tier
+{
+public:
+	static constexpr uint32_t no_particle = ~0u;
+
+	//! \param radius bounding sphere radius of body shape
+	void add(slab_handle h, btVector3 const & position, btVector3 const & velocity, btScalar radius);
+	void remove(slab_handle h);  //!< last particle takes the place of removed one
+	void clear();
+	uint32_t find(slab_handle h) const;  //!< \return particle index or no_particle
+	bool contains(slab_handle h) const {return find(h) != no_particle;}
+
+	void integrate(btScalar dt, btVector3 const & gravity);
+
+	void set(uint32_t idx, btVector3 const & position, btVector3 const & velocity);
+	btVector3 position(uint32_t idx) const;
+	btVector3 velocity(uint32_t idx) const;
+	btScalar radius(uint32_t idx) const {return _radius[idx];}
+	slab_handle handle(uint32_t idx) const {return _handles[idx];}
+	size_t size() const {return _handles.size();}
+
+private:
+	std::vector<btScalar> _position[3], _velocity[3];  // x, y, z arrays
+	std::vector<btScalar> _radius;
+	std::vector<slab_handle> _handles;  // body handles
+	std::vector<uint32_t> _index;  // particle index by body handle index
+};
+
+/*! Finds boxes overlapping any other box with a uniform grid (rebuilt by each find_near() call, buffers
+are reused). Boxes touching more than `max_box_cells` cells (e.g. ground) are tested against all boxes. */
+class proximity_grid
+{
+public:
+	static constexpr size_t max_box_cells = 8;
+
+	void clear() {_boxes.clear();}
+	void add(btVector3 const & min, btVector3 const & max);  //!< box index is the add() call order
+	size_t size() const {return _boxes.size();}
+
+	//! `near[i]` is set to 1 for boxes overlapping another box, \param cell_size about the biggest box size
+	void find_near(btScalar cell_size, std::vector<uint8_t> & near);
+
+private:
+	struct box
+	{
+		btScalar min[3], max[3];
+	};
+
+	std::vector<box> _boxes;
+	spatial_hash _hash;
+	std::vector<uint32_t> _large;
+};
+
+}  // physics
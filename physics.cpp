@@ -1,14 +1,24 @@
 #include <utility>
+#include <chrono>
 #include <ostream>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
 #include "physics.hpp"
+#include "trace.hpp"
+#include "box_narrowphase.hpp"
 
 using std::move, std::make_pair, std::swap;
+using std::make_unique;
 using std::size;
 using std::ostream;
+using std::chrono::steady_clock, std::chrono::duration;
+using std::thread, std::mutex, std::unique_lock, std::lock_guard;
 
 namespace physics {
 
 btVector3 calculate_local_inertia(btCollisionShape & shape, btScalar mass);
+contact_event make_begin_event(btPersistentManifold const & manifold);
+int collision_group(btCollisionObject const * o);
 
 body::body(shape_type && shape, btTransform && T, btScalar mass)
 	: _shape{move(shape)}
@@ -18,11 +28,32 @@ body::body(shape_type && shape, btTransform && T, btScalar mass)
 	assert(_shape && "shape required");
 }
 
+body::body(btVector3 const & box_half_extents, btTransform && T, btScalar mass)
+	: _box{std::in_place, box_half_extents}
+	, _motion{move(T)}
+	, _body{mass, &_motion, &*_box, calculate_local_inertia(*_box, mass)}
+{}
+
+body::body(shape_cache::shape_ref shape, btTransform && T, btScalar mass)
+	: _shared_shape{move(shape)}
+	, _motion{move(T)}
+	, _body{mass, &_motion, _shared_shape.get(), calculate_local_inertia(*_shared_shape.get(), mass)}
+{
+	assert(_shared_shape && "shape required");
+}
+
 btVector3 const & body::position() const
 {
 	return _body.getWorldTransform().getOrigin();
 }
 
+void body::set_collision_filter(int group, int mask)
+{
+	_has_filter = true;
+	_collision_group = group;
+	_collision_mask = mask;
+}
+
 btVector3 calculate_local_inertia(btCollisionShape & shape, btScalar mass)
 {
 	btVector3 local_inertia = {0, 0, 0};
@@ -32,52 +63,666 @@ btVector3 calculate_local_inertia(btCollisionShape & shape, btScalar mass)
 }
 
 
-world::world()
-	: _dispatcher{&_config}
-	, _world{&_dispatcher, &_pair_cache, &_solver, &_config}
-{}
+world::world(world_options const & opts)
+	: _fixed_step{opts.fixed_step}
+	, _particle_opts{opts.particles}
+{
+	create_broadphase(opts);
+
+	if (opts.multithreaded)
+		create_multithreaded(opts);
+	else
+	{
+		_config = make_unique<btDefaultCollisionConfiguration>();
+		if (opts.box_culling)
+			_dispatcher = make_unique<box_dispatcher<btCollisionDispatcher>>(_config.get());
+		else
+			_dispatcher = make_unique<btCollisionDispatcher>(_config.get());
+
+		_solver = make_unique<btSequentialImpulseConstraintSolver>();
+		_world = make_unique<btDiscreteDynamicsWorld>(_dispatcher.get(), _broadphase.get(), _solver.get(),
+			_config.get());
+		_query_scheduler = opts.scheduler;  // queries only, not set as Bullet scheduler
+	}
+}
+
+world::~world()
+{
+	if (_worker.joinable())
+	{
+		{
+			lock_guard<mutex> lock{_async_mutex};
+			_quit = true;
+		}
+		_async_cond.notify_all();
+		_worker.join();
+	}
+
+	_world.reset();
+
+	if (_scheduler && btGetTaskScheduler() == _scheduler.get())
+		btSetTaskScheduler(btGetSequentialTaskScheduler());
+}
+
+void world::create_multithreaded(world_options const & opts)
+{
+	btITaskScheduler * scheduler = opts.scheduler;
+	if (!scheduler)
+	{
+		_scheduler = make_unique<task_scheduler>(opts.thread_count);
+		scheduler = _scheduler.get();
+	}
+	else if (opts.thread_count > 0)
+		scheduler->setNumThreads(opts.thread_count);
+
+	btSetTaskScheduler(scheduler);  // Bullet uses one global scheduler
+	_query_scheduler = scheduler;
+
+	// collision algorithm and manifold pools needs to be big enough, growing them is not thread safe
+	btDefaultCollisionConstructionInfo cci;
+	cci.m_defaultMaxPersistentManifoldPoolSize = 80000;
+	cci.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+	_config = make_unique<btDefaultCollisionConfiguration>(cci);
+
+	if (opts.box_culling)
+		_dispatcher = make_unique<box_dispatcher<btCollisionDispatcherMt>>(_config.get());
+	else
+		_dispatcher = make_unique<btCollisionDispatcherMt>(_config.get());
+
+	_solver_pool = make_unique<btConstraintSolverPoolMt>(scheduler->getNumThreads());
+	_solver = make_unique<btSequentialImpulseConstraintSolverMt>();  // for big islands
+	_world = make_unique<btDiscreteDynamicsWorldMt>(_dispatcher.get(), _broadphase.get(), _solver_pool.get(),
+		_solver.get(), _config.get());
+}
+
+void world::create_broadphase(world_options const & opts)
+{
+	_broadphase_type = opts.broadphase;
+	switch (opts.broadphase)
+	{
+		case broadphase_type::dbvt:
+			_broadphase = make_unique<btDbvtBroadphase>();
+			break;
+
+		case broadphase_type::axis_sweep:
+		{
+			btVector3 const extent{opts.world_extent, opts.world_extent, opts.world_extent};
+			_broadphase = make_unique<bt32BitAxisSweep3>(-extent, extent);  // btAxisSweep3 is limited to 16k bodies
+			break;
+		}
+
+		case broadphase_type::grid:
+			_broadphase = make_unique<grid_broadphase>(opts.grid_cell_size);
+			break;
+	}
+}
+
+//! access to bt32BitAxisSweep3 pair cache, there is no setter
+struct axis_sweep_access : public bt32BitAxisSweep3
+{
+	static btOverlappingPairCache *& pair_cache(bt32BitAxisSweep3 & b)
+	{
+		return b.*(&axis_sweep_access::m_pairCache);
+	}
+};
+
+btOverlappingPairCache * world::replace_pair_cache(btOverlappingPairCache * pairs)
+{
+	btOverlappingPairCache * prev = nullptr;
+	switch (_broadphase_type)
+	{
+		case broadphase_type::dbvt:
+		{
+			btDbvtBroadphase & dbvt = static_cast<btDbvtBroadphase &>(*_broadphase);
+			prev = dbvt.m_paircache;
+			dbvt.m_paircache = pairs;
+			break;
+		}
+
+		case broadphase_type::axis_sweep:
+		{
+			btOverlappingPairCache *& cache = axis_sweep_access::pair_cache(
+				static_cast<bt32BitAxisSweep3 &>(*_broadphase));
+			prev = cache;
+			cache = pairs;
+			break;
+		}
+
+		case broadphase_type::grid:
+			prev = static_cast<grid_broadphase &>(*_broadphase).set_pair_cache(pairs);
+			break;
+	}
+	return prev;
+}
 
 void world::add_body(body * b)
 {
-	_world.addRigidBody(&b->rigid_body());
+	add_rigid_body(*b);
+}
+
+void world::add_rigid_body(body & b)
+{
+	_query_snapshot_valid = false;
+	if (b.has_collision_filter())
+		_world->addRigidBody(&b.rigid_body(), b.collision_group(), b.collision_mask());
+	else
+		_world->addRigidBody(&b.rigid_body());
+}
+
+void world::set_collision_filter(body_handle h, int group, int mask)
+{
+	body & b = get(h);
+	b.set_collision_filter(group, mask);
+
+	// Bullet way to refresh filter, pairs of the old filter are removed with the proxy
+	if (b.rigid_body().isInWorld())
+	{
+		_world->removeRigidBody(&b.rigid_body());
+		add_rigid_body(b);
+	}
 }
 
 void world::remove_body(body * b)
 {
-	_world.removeRigidBody(&b->rigid_body());
+	_query_snapshot_valid = false;
+	_world->removeRigidBody(&b->rigid_body());
+}
+
+void world::destroy_body(body_handle h)
+{
+	body & b = get(h);
+	if (_particles.contains(h))
+		_particles.remove(h);
+	else if (b.rigid_body().isInWorld())
+		_world->removeRigidBody(&b.rigid_body());
+	_bodies.destroy(h);
+	_query_snapshot_valid = false;
+}
+
+void world::add_body(body_handle h)
+{
+	assert(!_particles.contains(h) && "body already simulated");
+	add_rigid_body(get(h));
+}
+
+void world::remove_body(body_handle h)
+{
+	_query_snapshot_valid = false;
+	if (_particles.contains(h))
+		_particles.remove(h);
+	else
+		_world->removeRigidBody(&get(h).rigid_body());
+}
+
+body & world::get(body_handle h)
+{
+	body * b = _bodies.get(h);
+	assert(b && "dead body handle");
+	return *b;
+}
+
+//! access to btDiscreteDynamicsWorld::m_nonStaticRigidBodies, Bullet can only remove them one by one (linear search)
+struct nonstatic_bodies_access : public btDiscreteDynamicsWorld
+{
+	static btAlignedObjectArray<btRigidBody *> & get(btDiscreteDynamicsWorld & w)
+	{
+		return w.*(&nonstatic_bodies_access::m_nonStaticRigidBodies);
+	}
+};
+
+//! removes overlapping pairs with at least one marked body
+struct marked_pairs_remover : public btOverlapCallback
+{
+	std::vector<uint8_t> const & marks;
+
+	explicit marked_pairs_remover(std::vector<uint8_t> const & marks)
+		: marks{marks}
+	{}
+
+	bool processOverlap(btBroadphasePair & pair) override
+	{
+		return marked(pair.m_pProxy0) || marked(pair.m_pProxy1);
+	}
+
+	bool marked(btBroadphaseProxy const * proxy) const
+	{
+		int const idx = static_cast<btCollisionObject const *>(proxy->m_clientObject)->getWorldArrayIndex();
+		return idx >= 0 && idx < static_cast<int>(size(marks)) && marks[idx];
+	}
+};
+
+void world::add_bodies(handle_range bodies)
+{
+	// grow Bullet arrays once
+	int const count = static_cast<int>(bodies.size());
+	btCollisionObjectArray & colls = _world->getCollisionObjectArray();
+	colls.reserve(size(colls) + count);
+	btAlignedObjectArray<btRigidBody *> & nonstatic = nonstatic_bodies_access::get(*_world);
+	nonstatic.reserve(size(nonstatic) + count);
+
+	for (body_handle h : bodies)
+		add_rigid_body(get(h));
+}
+
+void world::remove_bodies(handle_range bodies)
+{
+	_query_snapshot_valid = false;
+
+	for (body_handle h : bodies)
+	{
+		if (_particles.contains(h))
+			_particles.remove(h);
+	}
+
+	if (mark_bodies(bodies) > 0)
+		remove_marked_pairs();
+
+	int marked_nonstatic = 0;
+	for (int idx : _batch_marked)
+	{
+		if (!_world->getCollisionObjectArray()[idx]->isStaticObject())
+			++marked_nonstatic;
+	}
+
+	/* non static bodies are searched from the tail (the last added bodies are usually removed first) till
+	all marked are found, kept bodies of the searched part are compacted in place */
+	btAlignedObjectArray<btRigidBody *> & nonstatic = nonstatic_bodies_access::get(*_world);
+	int first = size(nonstatic);
+	for (int found = 0; found < marked_nonstatic && first > 0;)
+	{
+		if (_batch_marks[nonstatic[--first]->getWorldArrayIndex()])
+			++found;
+	}
+
+	int kept = first;
+	for (int i = first; i < size(nonstatic); ++i)
+	{
+		int const idx = nonstatic[i]->getWorldArrayIndex();
+		if (!_batch_marks[idx])
+			nonstatic[kept++] = nonstatic[i];
+	}
+	nonstatic.resize(kept);
+
+	unmark_bodies();  // before removal, removing changes world array indices
+
+	/* pairs are already removed, so proxies can be destroyed without searching for their pairs (null
+	pair cache), collision object array removal is O(1) thanks to world array index */
+	btNullPairCache null_pairs;
+	btOverlappingPairCache * pairs = replace_pair_cache(&null_pairs);
+
+	for (body_handle h : bodies)
+	{
+		btRigidBody & rb = get(h).rigid_body();
+		if (rb.isInWorld())
+			_world->btCollisionWorld::removeCollisionObject(&rb);
+	}
+
+	replace_pair_cache(pairs);
+}
+
+void world::destroy_bodies(handle_range bodies)
+{
+	remove_bodies(bodies);
+	for (body_handle h : bodies)
+		_bodies.destroy(h);
+}
+
+void world::teleport_bodies(handle_range bodies, btTransform const * transforms,
+	btVector3 const * linear_velocities)
+{
+	_query_snapshot_valid = false;
+	// pairs from the old place, must go before proxies are moved (moving creates new pairs)
+	if (mark_bodies(bodies) > 0)  // bodies out of simulation have no pairs
+		remove_marked_pairs();
+	unmark_bodies();
+
+	btVector3 const zero{0, 0, 0};
+	size_t i = 0;
+	for (body_handle h : bodies)
+	{
+		btRigidBody & rb = get(h).rigid_body();
+		btTransform const & T = transforms[i];
+
+		rb.setWorldTransform(T);
+		rb.setInterpolationWorldTransform(T);
+		if (rb.getMotionState())
+			rb.getMotionState()->setWorldTransform(T);
+
+		btVector3 const & v = linear_velocities ? linear_velocities[i] : zero;
+		rb.setLinearVelocity(v);
+		rb.setInterpolationLinearVelocity(v);
+		rb.setAngularVelocity(zero);
+		rb.setInterpolationAngularVelocity(zero);
+		rb.clearForces();
+		rb.activate(true);
+
+		if (rb.isInWorld())
+		{
+			_world->updateSingleAabb(&rb);
+
+			int const idx = rb.getWorldArrayIndex();
+			if (idx < static_cast<int>(size(_previous_owners)) && _previous_owners[idx] == &rb)
+				_previous_transforms[idx] = T;  // no interpolation from the old place
+		}
+		else if (uint32_t const idx = _particles.find(h); idx != particle_tier::no_particle)
+			_particles.set(idx, T.getOrigin(), v);
+
+		++i;
+	}
+}
+
+/*! marks are cleared by unmark_bodies(), so the cost is proportional to the batch size (not the number
+of bodies in the world) \return number of marked bodies (bodies in simulation) */
+size_t world::mark_bodies(handle_range bodies)
+{
+	size_t const body_count = size(_world->getCollisionObjectArray());
+	if (size(_batch_marks) < body_count)
+		_batch_marks.resize(body_count, 0);
+
+	assert(_batch_marked.empty());
+	for (body_handle h : bodies)
+	{
+		int const idx = get(h).rigid_body().getWorldArrayIndex();
+		if (idx >= 0 && !_batch_marks[idx])
+		{
+			_batch_marks[idx] = 1;
+			_batch_marked.push_back(idx);
+		}
+	}
+	return size(_batch_marked);
+}
+
+void world::unmark_bodies()
+{
+	for (int idx : _batch_marked)
+		_batch_marks[idx] = 0;
+	_batch_marked.clear();
+}
+
+//! one pass over overlapping pairs instead of one pass per body
+void world::remove_marked_pairs()
+{
+	marked_pairs_remover remover{_batch_marks};
+	_broadphase->getOverlappingPairCache()->processAllOverlappingPairs(&remover, _dispatcher.get());
 }
 
 void world::simulate(btScalar time_step, int sub_steps)
 {
-	_world.stepSimulation(time_step, sub_steps);
+	_world->stepSimulation(time_step, sub_steps);
+	step_particles(time_step);
+	_query_snapshot_valid = false;
 	handle_collisions();
+
+	if (_recorder)
+		_recorder->write_frame(*this);
+}
+
+fixed_step_stats world::simulate_fixed(btScalar frame_time)
+{
+	PHYSICS_PROFILE_SCOPE("simulate_fixed");
+
+	btScalar const step = _fixed_step.step;
+	_accumulator += frame_time;
+
+	int const wanted_steps = static_cast<int>(_accumulator / step);
+
+	steady_clock::time_point const t0 = steady_clock::now();
+
+	int steps = 0;
+	while (steps < wanted_steps && steps < _fixed_step.max_steps)
+	{
+		if (steps > 0)  // would the next step fit into the budget?
+		{
+			duration<double> const elapsed = steady_clock::now() - t0;
+			if (elapsed.count() * (steps + 1) / steps > _fixed_step.budget)
+				break;
+		}
+
+		save_previous_transforms();
+		_world->stepSimulation(step, 0);  // exactly one step
+		step_particles(step);
+		_accumulator -= step;
+		++steps;
+	}
+
+	// drop time we are not able to simulate, but keep the sub-step remainder
+	btScalar const dropped_time = (wanted_steps - steps) * step;
+	_accumulator -= dropped_time;
+
+	if (steps > 0)
+	{
+		_query_snapshot_valid = false;
+		handle_collisions();
+	}
+	else
+		_contact_events.clear();  // nothing happened this frame
+
+	_alpha = _accumulator / step;
+
+	PHYSICS_PROFILE_COUNTER("active bodies", active_body_count());
+
+	if (_recorder)
+		_recorder->write_frame(*this);
+
+	return fixed_step_stats{steps, dropped_time, _alpha};
+}
+
+btTransform world::interpolated_transform(body const & b) const
+{
+	btRigidBody const & rb = b.rigid_body();
+	btTransform const & current = rb.getWorldTransform();
+
+	int const idx = rb.getWorldArrayIndex();
+	if (idx < 0 || idx >= static_cast<int>(size(_previous_owners)) || _previous_owners[idx] != &rb)
+		return current;  // body was not simulated in the last step
+
+	btTransform const & previous = _previous_transforms[idx];
+
+	btTransform T;
+	T.setOrigin(previous.getOrigin().lerp(current.getOrigin(), _alpha));
+	T.setRotation(previous.getRotation().slerp(current.getRotation(), _alpha));
+	return T;
+}
+
+btTransform world::interpolated_transform(body_handle h) const
+{
+	uint32_t const idx = _particles.find(h);
+	if (idx == particle_tier::no_particle)
+		return interpolated_transform(*_bodies.get(h));
+
+	// particle moves along straight line within a step
+	btTransform T = _bodies.get(h)->rigid_body().getWorldTransform();
+	btVector3 p = _particles.position(idx);
+	if (!_previous_owners.empty())  // simulate_fixed() is used
+		p -= _particles.velocity(idx) * ((1 - _alpha) * _fixed_step.step);
+	T.setOrigin(p);
+	return T;
+}
+
+btTransform world::transform(body_handle h) const
+{
+	body const * b = _bodies.get(h);
+	assert(b && "dead body handle");
+	btTransform T = b->rigid_body().getWorldTransform();
+
+	uint32_t const idx = _particles.find(h);
+	if (idx != particle_tier::no_particle)
+		T.setOrigin(_particles.position(idx));
+
+	return T;
+}
+
+void world::step_async(btScalar frame_time)
+{
+	if (!_worker.joinable())
+		_worker = thread{[this]{async_loop();}};
+
+	{
+		lock_guard<mutex> lock{_async_mutex};
+		assert(!_stepping && "wait() call expected");
+		_async_frame_time = frame_time;
+		_step_requested = true;
+		_stepping = true;
+	}
+	_async_cond.notify_all();
+}
+
+void world::wait()
+{
+	unique_lock<mutex> lock{_async_mutex};
+	_async_cond.wait(lock, [this]{return !_stepping;});
+}
+
+world_snapshot const & world::latest_snapshot()
+{
+	_snapshots.update();
+	return _snapshots.front();
+}
+
+void world::async_loop()
+{
+	PHYSICS_PROFILE_THREAD("physics");
+
+	unique_lock<mutex> lock{_async_mutex};
+	while (true)
+	{
+		_async_cond.wait(lock, [this]{return _step_requested || _quit;});
+		if (_quit)
+			return;
+
+		btScalar const frame_time = _async_frame_time;
+		_step_requested = false;
+		lock.unlock();
+
+		fixed_step_stats const stats = simulate_fixed(frame_time);
+		write_snapshot(_snapshots.back(), stats);
+		_snapshots.publish();
+
+		lock.lock();
+		_stepping = false;
+		_async_cond.notify_all();
+	}
+}
+
+void world::write_snapshot(world_snapshot & s, fixed_step_stats const & stats)
+{
+	size_t const slot_count = _bodies.capacity();
+	s.positions.resize(3*slot_count);
+	s.orientations.resize(4*slot_count);
+	s.generations.assign(slot_count, world_snapshot::dead_body);
+
+	export_transforms(s.positions.data(), s.orientations.data(), true);
+
+	_bodies.for_each([&s](body_handle h, body const &){
+		s.generations[h.index] = h.generation;
+	});
+
+	s.events.assign(begin(_contact_events), end(_contact_events));
+	s.stats = stats;
+	s.frame = ++_async_frame;
+}
+
+size_t world::export_transforms(float * positions, float * orientations, bool interpolated) const
+{
+	size_t count = 0;
+	_bodies.for_each([&](body_handle h, body const &){
+		btTransform const T = interpolated ? interpolated_transform(h) : transform(h);
+
+		btVector3 const & p = T.getOrigin();
+		float * pos = positions + 3*h.index;
+		pos[0] = p.x();
+		pos[1] = p.y();
+		pos[2] = p.z();
+
+		btQuaternion const q = T.getRotation();
+		float * rot = orientations + 4*h.index;
+		rot[0] = q.x();
+		rot[1] = q.y();
+		rot[2] = q.z();
+		rot[3] = q.w();
+
+		++count;
+	});
+	return count;
+}
+
+void world::save_previous_transforms()
+{
+	btCollisionObjectArray const & colls = _world->getCollisionObjectArray();
+	int const count = size(colls);
+
+	_previous_transforms.resize(count);
+	_previous_owners.resize(count);
+
+	for (int i = 0; i < count; ++i)
+	{
+		_previous_transforms[i] = colls[i]->getWorldTransform();
+		_previous_owners[i] = colls[i];
+	}
 }
 
 world::collision_range world::collision_objects()
 {
-	btCollisionObjectArray const & colls = _world.getCollisionObjectArray();
+	btCollisionObjectArray const & colls = _world->getCollisionObjectArray();
 	return collision_range{&colls[0], &colls[size(colls)]};
 }
 
-void world::subscribe_collisions(collision_listener * l)
+void world::subscribe_collisions(collision_listener * l, int groups)
 {
-	_collision_listeners.push_back(l);
+	_collision_listeners.push_back(subscription{l, groups});
+	_listener_groups |= groups;
 }
 
 void world::unsubscribe_collisions(collision_listener * l)
 {
-	auto it = find(begin(_collision_listeners), end(_collision_listeners), l);
+	auto it = find_if(begin(_collision_listeners), end(_collision_listeners),
+		[l](subscription const & s){return s.listener == l;});
 	if (it != end(_collision_listeners))
 		_collision_listeners.erase(it);
+
+	_listener_groups = 0;
+	for (subscription const & s : _collision_listeners)
+		_listener_groups |= s.groups;
+}
+
+world::contact_event_range world::contact_events() const
+{
+	return contact_event_range{_contact_events.data(), _contact_events.data() + size(_contact_events)};
+}
+
+void world::publish_contact_events(contact_event_queue * q)
+{
+	_event_queue = q;
+}
+
+int world::active_body_count() const
+{
+	btCollisionObjectArray const & colls = _world->getCollisionObjectArray();
+	int count = 0;
+	for (int i = 0; i < size(colls); ++i)
+		count += colls[i]->isActive() ? 1 : 0;
+	return count;
 }
 
 void world::handle_collisions()
 {
+	PHYSICS_PROFILE_SCOPE("handle_collisions");
+	PHYSICS_PROFILE_COUNTER("pairs", _broadphase->getOverlappingPairCache()->getNumOverlappingPairs());
+	PHYSICS_PROFILE_COUNTER("manifolds", _dispatcher->getNumManifolds());
+
+	_contact_events.clear();
+
+	// pairs nobody is interested in are not tracked at all
+	int const interest = _event_groups | _listener_groups;
+	if (!interest && _last_collisions.empty())
+		return;
+
 	// collisions this update
-	collision_pairs pairs_this_update;
-	for (int i = 0; i < _dispatcher.getNumManifolds(); ++i)
+	_pairs_this_update.clear();
+	for (int i = 0; i < _dispatcher->getNumManifolds(); ++i)
 	{
-		btPersistentManifold * manifold = _dispatcher.getManifoldByIndexInternal(i);
+		btPersistentManifold * manifold = _dispatcher->getManifoldByIndexInternal(i);
+		PHYSICS_PROFILE_COUNTER("contacts", manifold->getNumContacts());
 		if (manifold->getNumContacts() > 0)
 		{
 			auto body0 = manifold->getBody0();
@@ -88,34 +733,97 @@ void world::handle_collisions()
 			auto sorted_body_a = swapped ? body1 : body0;
 			auto sorted_body_b = swapped ? body0 : body1;
 			auto collision = make_pair(sorted_body_a, sorted_body_b);
-			pairs_this_update.insert(collision);
 
-			if (_last_collisions.find(collision) == _last_collisions.end())
-				collision_event((btCollisionObject *)body0, (btCollisionObject *)body1);
+			int const groups = collision_group(body0) | collision_group(body1);
+			if (!(groups & interest))
+				continue;
+
+			bool const first_manifold = _pairs_this_update.insert(collision, static_cast<uint32_t>(groups));
+			if (!_last_collisions.contains(collision))
+			{
+				if (first_manifold && (groups & _event_groups))  // one begin event per pair
+					_contact_events.push_back(make_begin_event(*manifold));
+				collision_event((btCollisionObject *)body0, (btCollisionObject *)body1, groups);  // once per manifold
+			}
 		}
 	}
 
-	// collisions removed this update
-	collision_pairs removed_pairs;
-	set_difference(_last_collisions.begin(), _last_collisions.end(),
-		pairs_this_update.begin(), pairs_this_update.end(), inserter(removed_pairs, removed_pairs.begin()));
+	// collisions removed this update, bodies can be already destroyed (groups are taken from the tag)
+	for (size_t i = 0; i < size(_last_collisions); ++i)
+	{
+		auto const & collision = _last_collisions.begin()[i];
+		if (!_pairs_this_update.contains(collision))
+		{
+			int const groups = static_cast<int>(_last_collisions.tag(i));
+			if (groups & _event_groups)
+			{
+				_contact_events.push_back(contact_event{contact_event::end, collision.first, collision.second,
+					btVector3{0,0,0}, btVector3{0,0,0}, 0});
+			}
+			separation_event((btCollisionObject *)collision.first, (btCollisionObject *)collision.second, groups);
+		}
+	}
+
+	swap(_last_collisions, _pairs_this_update);
 
-	for (auto const & collision : removed_pairs)
-		separation_event((btCollisionObject *)collision.first, (btCollisionObject *)collision.second);
+	if (_event_queue)
+	{
+		size_t const pushed = _event_queue->push(_contact_events.data(), size(_contact_events));
+		_dropped_events += size(_contact_events) - pushed;
+	}
+}
 
-	swap(_last_collisions, pairs_this_update);
+//! collision filter group of body in simulation
+int collision_group(btCollisionObject const * o)
+{
+	btBroadphaseProxy const * proxy = o->getBroadphaseHandle();
+	return proxy ? proxy->m_collisionFilterGroup : 0;
 }
 
-void world::collision_event(btCollisionObject * a, btCollisionObject * b)
+contact_event make_begin_event(btPersistentManifold const & manifold)
 {
-	for (auto * l : _collision_listeners)
-		l->on_collision(a, b);
+	contact_event e{contact_event::begin, manifold.getBody0(), manifold.getBody1(),
+		btVector3{0,0,0}, btVector3{0,0,0}, 0};
+
+	btScalar deepest = BT_LARGE_FLOAT;
+	for (int i = 0; i < manifold.getNumContacts(); ++i)
+	{
+		btManifoldPoint const & pt = manifold.getContactPoint(i);
+		e.impulse += pt.getAppliedImpulse();
+		if (pt.getDistance() < deepest)
+		{
+			deepest = pt.getDistance();
+			e.point = pt.getPositionWorldOnB();
+			e.normal = pt.m_normalWorldOnB;
+		}
+	}
+
+	return e;
+}
+
+void world::collision_event(btCollisionObject * a, btCollisionObject * b, int groups)
+{
+	PHYSICS_PROFILE_SCOPE("collision listeners");
+	for (subscription const & s : _collision_listeners)
+	{
+		if (s.groups & groups)
+			s.listener->on_collision(a, b);
+	}
+}
+
+void world::separation_event(btCollisionObject * a, btCollisionObject * b, int groups)
+{
+	PHYSICS_PROFILE_SCOPE("separation listeners");
+	for (subscription const & s : _collision_listeners)
+	{
+		if (s.groups & groups)
+			s.listener->on_separation(a, b);
+	}
 }
 
-void world::separation_event(btCollisionObject * a, btCollisionObject * b)
+bool world_snapshot::contains(body_handle h) const
 {
-	for (auto * l : _collision_listeners)
-		l->on_separation(a, b);
+	return h.index < size(generations) && generations[h.index] == h.generation;
 }
 
 btTransform translate(btVector3 const & v)
@@ -1,13 +1,32 @@
 #pragma once
-#include <set>
+#include <vector>
+#include <string>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
 #include <iosfwd>
 #include <boost/range/iterator_range.hpp>
 #include <bullet/btBulletDynamicsCommon.h>
 #include <bullet/BulletCollision/btBulletCollisionCommon.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include "collision_pairs.hpp"
+#include "spsc_ring.hpp"
+#include "task_scheduler.hpp"
+#include "slab_pool.hpp"
+#include "shape_cache.hpp"
+#include "grid_broadphase.hpp"
+#include "particle_tier.hpp"
+#include "triple_buffer.hpp"
+#include "profiler.hpp"
 
 namespace physics {
 
+class trace_recorder;
+
 class body
 {
 public:
@@ -19,18 +38,39 @@ public:
 	using shape_type = std::unique_ptr<btCollisionShape>;
 
 	body(shape_type && shape, btTransform && T, btScalar mass = 0);
+
+	//! body with box shape stored inline (no shape allocation)
+	body(btVector3 const & box_half_extents, btTransform && T, btScalar mass = 0);
+
+	//! body with shared shape (see shape_cache)
+	body(shape_cache::shape_ref shape, btTransform && T, btScalar mass = 0);
+
 	btVector3 const & position() const;
 
+	/*! Bullet collision filter (btBroadphaseProxy::CollisionFilterGroups bits) used when body is added
+	to world, bodies collide if `(group_a & mask_b) && (group_b & mask_a)`. Bodies without filter get
+	Bullet defaults. Use world::set_collision_filter() for bodies in simulation. */
+	void set_collision_filter(int group, int mask);
+	bool has_collision_filter() const {return _has_filter;}
+	int collision_group() const {return _collision_group;}
+	int collision_mask() const {return _collision_mask;}
+
 	// native geters
 	btRigidBody & rigid_body() {return _body;}
+	btRigidBody const & rigid_body() const {return _body;}
 
 	template <typename T>
 	bool is_same(T * p) const {return (void *)p == &_body;}
 
 private:
 	shape_type _shape;
+	shape_cache::shape_ref _shared_shape;
+	std::optional<btBoxShape> _box;
 	btDefaultMotionState _motion;
 	btRigidBody _body;
+	bool _has_filter = false;
+	int _collision_group = 0,
+		_collision_mask = 0;
 };
 
 struct collision_listener
@@ -39,41 +79,440 @@ struct collision_listener
 	virtual void on_separation(btCollisionObject * a, btCollisionObject * b) {}
 };
 
+//! contact begin/end event with contact details taken from btPersistentManifold
+struct contact_event
+{
+	enum event_type {begin, end};
+
+	event_type type;
+	btCollisionObject const * a;
+	btCollisionObject const * b;
+	btVector3 point;  //!< deepest contact point (on b) in world space, zero for end events
+	btVector3 normal;  //!< contact normal (on b) in world space, zero for end events
+	btScalar impulse;  //!< sum of applied impulses of all manifold contacts, zero for end events
+};
+
+using contact_event_queue = spsc_ring<contact_event>;
+
+//! handle to world owned body, see world::create_body()
+using body_handle = slab_handle;
+
+//! fixed time step simulation settings, see world::simulate_fixed()
+struct fixed_step_options
+{
+	btScalar step = btScalar(1)/60;  //!< simulation step in s
+	int max_steps = 4;  //!< maximum number of steps per frame
+	double budget = 0.004;  //!< CPU time budget for simulation per frame in s
+};
+
+//! world::simulate_fixed() result
+struct fixed_step_stats
+{
+	int steps;  //!< steps simulated this frame
+	btScalar dropped_time;  //!< simulation time dropped because of step limits in s
+	btScalar alpha;  //!< interpolation factor between previous and current step state
+};
+
+//! body transforms and contact events published by asynchronous simulation, see world::step_async()
+struct world_snapshot
+{
+	static constexpr uint32_t dead_body = ~0u;
+
+	std::vector<float> positions;  //!< interpolated body positions (x, y, z) indexed by body_handle::index
+	std::vector<float> orientations;  //!< interpolated body orientations (x, y, z, w) indexed by body_handle::index
+	std::vector<uint32_t> generations;  //!< body_handle::generation for each slot, dead_body for empty slot
+	std::vector<contact_event> events;  //!< contact events of the simulated frame
+	fixed_step_stats stats = {};
+	uint64_t frame = 0;  //!< number of simulated step_async() frames
+
+	bool contains(body_handle h) const;
+	size_t slot_count() const {return generations.size();}
+};
+
+/*! Flat copy of world owned bodies state (transform, velocities, activation) and contact cache
+(manifold points), see world::checkpoint(). Buffers are reused between checkpoint() calls.
+\note saved file is raw copy of the buffers, it can be loaded only by the same build */
+struct world_checkpoint
+{
+	struct body_state
+	{
+		body_handle handle;
+		int32_t user_index;
+		int32_t shape_type;  //!< BroadphaseNativeTypes value
+		float shape_dims[3];  //!< box half extents or sphere radius
+		float mass;
+		float origin[3];
+		float rotation[4];  //!< x, y, z, w
+		float linear_velocity[3];
+		float angular_velocity[3];
+		int32_t activation_state;
+		float deactivation_time;
+		int32_t in_world;
+	};
+
+	struct manifold_state
+	{
+		uint32_t body_a, body_b;  //!< index into bodies
+		uint32_t first_point, point_count;  //!< range in points
+	};
+
+	struct contact_point
+	{
+		float local_a[3], local_b[3];
+		float world_a[3], world_b[3];
+		float normal[3];  //!< normal on B in world space
+		float distance;
+		float applied_impulse, lateral_impulse1, lateral_impulse2;
+		float lateral_dir1[3], lateral_dir2[3];
+		float friction, restitution;
+		int32_t lifetime;
+	};
+
+	std::vector<body_state> bodies;
+	std::vector<manifold_state> manifolds;
+	std::vector<contact_point> points;
+	float accumulator = 0;  //!< fixed step accumulator
+
+	bool save(std::string const & path) const;
+	bool load(std::string const & path);  //!< \return false for missing, truncated or corrupt file
+};
+
+//! ray for world::raycast_batch()
+struct ray
+{
+	btVector3 from, to;
+};
+
+//! closest ray hit, see world::raycast_batch()
+struct ray_hit
+{
+	btCollisionObject const * object;  //!< nullptr if nothing was hit
+	btVector3 point;  //!< world space hit point
+	btVector3 normal;  //!< world space surface normal
+	btScalar fraction;  //!< hit position along the ray in [0, 1], 1 for no hit
+
+	bool hit() const {return object != nullptr;}
+};
+
+//! axis aligned box for world::query_aabb()
+struct aabb
+{
+	btVector3 min, max;
+};
+
+/*! Reusable output buffer of batched queries (world::query_aabb(), world::nearest_k()), results of
+the i-th query are `objects[offsets[i]]` till `objects[offsets[i+1]]`. Buffers only grow. */
+struct query_result
+{
+	using object_range = boost::iterator_range<btCollisionObject const * const *>;
+
+	std::vector<btCollisionObject const *> objects;
+	std::vector<btScalar> distances;  //!< nearest_k() only, distance of objects[j] from the query point
+	std::vector<uint32_t> offsets;  //!< query count + 1 items
+
+	size_t query_count() const {return offsets.empty() ? 0 : offsets.size() - 1;}
+	object_range operator[](size_t query) const;
+};
+
+//! broadphase algorithm, see world_options::broadphase
+enum class broadphase_type
+{
+	dbvt,  //!< btDbvtBroadphase, general purpose
+	axis_sweep,  //!< bt32BitAxisSweep3, bodies needs to stay within world_options::world_extent
+	grid  //!< grid_broadphase, many similarly sized bodies (cell size is world_options::grid_cell_size)
+};
+
+/*! Particle tier settings, see world_options::particles.
+
+Every `update_interval` steps each world owned dynamic body is checked against all other bodies with
+its AABB grown by the distance it can travel till the next check. Bodies outside of the focus sphere
+without any body around are removed from Bullet and integrated as particles (see particle_tier),
+particles which get close to other bodies or into the focus sphere are returned into Bullet.
+\note particles do not rotate or collide, sleeping, static and kinematic bodies are never particles */
+struct particle_options
+{
+	bool enabled = false;
+	btVector3 focus = btVector3{0, 0, 0};  //!< region of interest center, see world::set_focus()
+	btScalar focus_radius = 50;  //!< isolated bodies farther from focus are particles
+	btScalar margin = btScalar(0.25);  //!< extra gap body needs to keep from others to be particle
+	btScalar cell_size = 4;  //!< proximity grid cell size, about the biggest grown body AABB
+	int update_interval = 8;  //!< tiers are reassigned every n steps
+};
+
+//! world configuration
+struct world_options
+{
+	/*! use btDiscreteDynamicsWorldMt, btCollisionDispatcherMt and solver pool
+	\note Bullet needs to be build with BT_THREADSAFE, otherwise world runs in one thread */
+	bool multithreaded = false;
+	int thread_count = 0;  //!< number of threads for multithreaded world, 0 for all hardware threads
+	btITaskScheduler * scheduler = nullptr;  //!< multithreaded world and parallel queries task scheduler, task_scheduler is created by default
+	fixed_step_options fixed_step;
+	broadphase_type broadphase = broadphase_type::dbvt;
+	btScalar grid_cell_size = 2.5;  //!< about the biggest body AABB size (grid broadphase)
+	btScalar world_extent = 1000;  //!< world half size (axis sweep broadphase)
+	bool box_culling = false;  //!< skip narrowphase of separated box-box pairs (see box_pair_culler), measure with physics_bench first
+	particle_options particles;  //!< cheap particle tier for distant and isolated bodies (disabled by default)
+};
+
 class world
 {
 public:
 	using collision_range = boost::iterator_range<btCollisionObject * const *>;
+	using contact_event_range = boost::iterator_range<contact_event const *>;
+	using handle_range = boost::iterator_range<body_handle const *>;
+	using ray_range = boost::iterator_range<ray const *>;
+	using aabb_range = boost::iterator_range<aabb const *>;
+	using point_range = boost::iterator_range<btVector3 const *>;
 
-	world();
+	explicit world(world_options const & opts = world_options{});
+	~world();
 	void add_body(body * b);
 	void remove_body(body * b);
+
+	/*! creates body in world owned storage (see body::body() for arguments), body is not simulated till
+	add_body() call */
+	template <typename... Args>
+	body_handle create_body(Args &&... args);
+	void destroy_body(body_handle h);  //!< also removes body from simulation
+	void add_body(body_handle h);
+	void remove_body(body_handle h);
+	body & get(body_handle h);
+
+	/*! Batch versions of add_body(), remove_body() and destroy_body(). Overlapping pairs and Bullet
+	body arrays are processed once per batch, not once per body, so removing n bodies is linear.
+	\note bodies not in simulation are skipped by remove_bodies() */
+	void add_bodies(handle_range bodies);
+	void remove_bodies(handle_range bodies);
+	void destroy_bodies(handle_range bodies);
+
+	/*! Moves bodies to `transforms[i]` with `linear_velocities[i]` (zero velocity for nullptr), angular
+	velocity and forces are cleared. Broadphase proxies are updated (old pairs are removed in one pass)
+	and transform is not interpolated from the old place. */
+	void teleport_bodies(handle_range bodies, btTransform const * transforms,
+		btVector3 const * linear_velocities = nullptr);
+
+	/*! Copies state of all world owned bodies and their contact cache into `cp` (without allocation
+	once `cp` buffers are big enough). Restore with restore() in this world or with instantiate() in
+	a new one (e.g. pre-settled scene loaded from disk). */
+	void checkpoint(world_checkpoint & cp);
+
+	//! restores checkpoint taken from this world, all checkpoint bodies need to be alive
+	void restore(world_checkpoint const & cp);
+
+	/*! creates checkpoint bodies (box and sphere shapes only) in this world and restores their state
+	\return created bodies in checkpoint order */
+	std::vector<body_handle> instantiate(world_checkpoint const & cp);
+
+	/*! Casts `rays` in parallel (world task scheduler threads) and writes the closest hit of `rays[i]`
+	into `hits[i]`. Rays are tested against btDbvtBroadphase trees directly, particles and bodies of other
+	broadphases are put into a query tree by the first query after simulation or body changes, so world
+	needs to be idle (not between step_async() and wait()).
+	Only bodies with collision filter group in `groups` are hit, particles are hit as well.
+	\note body changes through native() are not tracked
+	\code
+	ray_hit hit;
+	ray const r{from, to};
+	w.raycast_batch(world::ray_range{&r, &r + 1}, &hit);
+	\endcode */
+	void raycast_batch(ray_range rays, ray_hit * hits, int groups = btBroadphaseProxy::AllFilter);
+
+	/*! Finds bodies which AABB overlaps `boxes[i]` for each box (in the calling thread), see
+	raycast_batch() for snapshot and `groups` details.
+	\code
+	query_result found;  // reused between frames
+	aabb const box{btVector3{-1, -1, -1}, btVector3{1, 1, 1}};
+	w.query_aabb(world::aabb_range{&box, &box + 1}, found);
+	for (btCollisionObject const * o : found[0])
+		...
+	\endcode */
+	void query_aabb(aabb_range boxes, query_result & result, int groups = btBroadphaseProxy::AllFilter);
+
+	/*! Finds up to `k` bodies nearest (body origin) to `points[i]` for each point in parallel, results
+	are sorted by distance. See raycast_batch() for snapshot and `groups` details. */
+	void nearest_k(point_range points, size_t k, query_result & result, int groups = btBroadphaseProxy::AllFilter);
+
+	shape_cache & shapes() {return _shapes;}  //!< shapes shared by world bodies
+
+	//! calls `f(body_handle, body &)` for all world owned bodies in memory order
+	template <typename F>
+	void for_each_body(F && f) {_bodies.for_each(std::forward<F>(f));}
+
+	template <typename F>
+	void for_each_body(F && f) const {_bodies.for_each(std::forward<F>(f));}
+
+	size_t body_capacity() const {return _bodies.capacity();}  //!< number of body slots
+
+	/*! Writes position (x, y, z) and orientation quaternion (x, y, z, w) of all world owned bodies into
+	`positions[3*i]` and `orientations[4*i]` arrays in one pass, where i is body_handle::index. Arrays
+	needs to be big enough for body_capacity() bodies, empty slots are not written.
+	\param interpolated use interpolated_transform() instead of current body transform
+	\return number of written bodies */
+	size_t export_transforms(float * positions, float * orientations, bool interpolated = false) const;
+
 	void simulate(btScalar time_step, int sub_steps = 10);
 
+	/*! Advances simulation by `frame_time` in fixed steps. Number of steps is limited by
+	fixed_step_options::max_steps and CPU time budget, time which does not fit is dropped (simulation
+	slows down instead of making next frame even slower). Use interpolated_transform() to render bodies. */
+	fixed_step_stats simulate_fixed(btScalar frame_time);
+
+	//! body transform interpolated between the last two fixed steps (see simulate_fixed())
+	btTransform interpolated_transform(body const & b) const;
+
+	//! interpolated_transform() which also works for particles (native transform of particle is not updated)
+	btTransform interpolated_transform(body_handle h) const;
+	btTransform transform(body_handle h) const;  //!< current body transform (particles included)
+
+	/*! Starts simulate_fixed(frame_time) in world worker thread and returns immediately. After the step
+	all body transforms and contact events are published as world_snapshot, see latest_snapshot().
+	World (bodies) can not be modified till wait() returns, collision listeners are called from worker
+	thread. */
+	void step_async(btScalar frame_time);
+	void wait();  //!< waits for the step started by step_async()
+
+	//! lock-free access to snapshot of the latest completed step_async() frame (consumer side)
+	world_snapshot const & latest_snapshot();
+
 	collision_range collision_objects();
 
-	void subscribe_collisions(collision_listener * l);
+	/*! Listener gets only collisions of pairs with at least one body from `groups` (collision filter
+	group bits, see body::set_collision_filter()). Pairs nobody is interested in (listeners and
+	event_groups()) are dropped before contact tracking. */
+	void subscribe_collisions(collision_listener * l, int groups = btBroadphaseProxy::AllFilter);
 	void unsubscribe_collisions(collision_listener * l);
 
-	btDiscreteDynamicsWorld & native() {return _world;}
+	//! contact_events(), published events and snapshot events only for pairs with body from `groups`
+	void set_event_groups(int groups) {_event_groups = groups;}
+	int event_groups() const {return _event_groups;}
 
-private:
-	using collision_pairs = std::set<std::pair<btCollisionObject const *,
-		btCollisionObject const *>>;
+	/*! Changes body collision filter, body in simulation is re-added (its pairs are removed). Bodies
+	which should never collide (e.g. `mask = 0`) are filtered out by broadphase. */
+	void set_collision_filter(body_handle h, int group, int mask);
+
+	/*! contact events from the last simulate() call as contiguous buffer (valid till next simulate() call)
+	\note begin events come in manifold order, end events follow them */
+	contact_event_range contact_events() const;
+
+	/*! Also publish contact events into `q` (nullptr to stop publishing), so other threads can drain them
+	without blocking simulate(). Events which do not fit into the queue are dropped. */
+	void publish_contact_events(contact_event_queue * q);
+	size_t dropped_contact_events() const {return _dropped_events;}
+
+	//! writes a trace frame into `r` after each simulate() and simulate_fixed() call (nullptr to stop)
+	void record(trace_recorder * r) {_recorder = r;}
+
+	int active_body_count() const;  //!< number of awake (simulated) bodies
+
+	//! particle tier region of interest center (e.g. camera position), see particle_options
+	void set_focus(btVector3 const & p) {_particle_opts.focus = p;}
+	size_t particle_count() const {return _particles.size();}
+	bool is_particle(body_handle h) const {return _particles.contains(h);}
 
+	btDiscreteDynamicsWorld & native() {return *_world;}
+	bool multithreaded() const {return _solver_pool != nullptr;}
+	broadphase_type broadphase() const {return _broadphase_type;}
+
+private:
 	void handle_collisions();
-	void collision_event(btCollisionObject * a, btCollisionObject * b);
-	void separation_event(btCollisionObject * a, btCollisionObject * b);
+	void save_previous_transforms();
+	void async_loop();
+	void write_snapshot(world_snapshot & s, fixed_step_stats const & stats);
+	void add_rigid_body(body & b);  // with body collision filter
+	void collision_event(btCollisionObject * a, btCollisionObject * b, int groups);
+	size_t mark_bodies(handle_range bodies);
+	void unmark_bodies();
+	void restore(world_checkpoint const & cp, body_handle const * handles);
+	void remove_marked_pairs();
+	void update_query_snapshot();
+	void step_particles(btScalar dt);
+	void update_tiers(btScalar step);
+	void promote(handle_range bodies);  // particles into Bullet
+	void demote(handle_range bodies);  // Bullet bodies into particles
+	btITaskScheduler & query_scheduler();
+	void separation_event(btCollisionObject * a, btCollisionObject * b, int groups);
+
+	void create_multithreaded(world_options const & opts);
+	void create_broadphase(world_options const & opts);
+	btOverlappingPairCache * replace_pair_cache(btOverlappingPairCache * pairs);  // returns previous
+
+	shape_cache _shapes;  // needs to outlive _bodies
+	slab_pool<body> _bodies;  // needs to outlive _world
+	std::unique_ptr<task_scheduler> _scheduler;  // default scheduler for multithreaded world
+	std::unique_ptr<btDefaultCollisionConfiguration> _config;
+	std::unique_ptr<btCollisionDispatcher> _dispatcher;
+	broadphase_type _broadphase_type;
+	std::unique_ptr<btBroadphaseInterface> _broadphase;
+	std::unique_ptr<btConstraintSolverPoolMt> _solver_pool;
+	std::unique_ptr<btConstraintSolver> _solver;
+	std::unique_ptr<btDiscreteDynamicsWorld> _world;
+
+	struct subscription
+	{
+		collision_listener * listener;
+		int groups;
+	};
+
+	collision_pairs _last_collisions,
+		_pairs_this_update;  // reused between updates to avoid allocations, tagged with pair collision groups
+	std::vector<subscription> _collision_listeners;
+	int _listener_groups = 0;  // all listeners groups
+	int _event_groups = btBroadphaseProxy::AllFilter;
+	std::vector<contact_event> _contact_events;
+	contact_event_queue * _event_queue = nullptr;
+	size_t _dropped_events = 0;
+	trace_recorder * _recorder = nullptr;
 
-	btDefaultCollisionConfiguration _config;
-	btCollisionDispatcher _dispatcher;
-	btDbvtBroadphase _pair_cache;
-	btSequentialImpulseConstraintSolver _solver;
-	btDiscreteDynamicsWorld _world;
+	// fixed step
+	fixed_step_options _fixed_step;
+	btScalar _accumulator = 0;
+	btScalar _alpha = 0;
+	std::vector<btTransform> _previous_transforms;  // indexed by world array index
+	std::vector<btCollisionObject const *> _previous_owners;
 
-	collision_pairs _last_collisions;
-	std::vector<collision_listener *> _collision_listeners;
+	std::vector<uint8_t> _batch_marks;  // batch operation bodies indexed by world array index, zero outside of batch
+	std::vector<int> _batch_marked;  // world array indices set in _batch_marks
+
+	// checkpoint scratch buffers
+	std::vector<uint32_t> _checkpoint_index;  // checkpoint body index by world array index
+	btManifoldArray _checkpoint_manifolds;
+
+	// queries
+	btITaskScheduler * _query_scheduler = nullptr;
+	std::vector<btDbvt const *> _query_trees;  // btDbvtBroadphase trees and _query_tree
+	btDbvt _query_tree;  // particles and bodies of other broadphases, updated after simulation or body changes
+	std::vector<btDbvtNode *> _query_leaves;  // _query_tree leaves, kept between updates
+	std::vector<btBroadphaseProxy> _particle_proxies;  // _query_tree leaf data of particles (no broadphase proxy)
+	bool _query_snapshot_valid = false;
+	std::vector<btDbvtNode const *> _query_stack;  // tree traversal, reused
+
+	// particle tier
+	particle_options _particle_opts;
+	particle_tier _particles;
+	proximity_grid _proximity;
+	std::vector<body_handle> _proximity_bodies;  // proximity box owner, invalid handle for other objects
+	std::vector<uint8_t> _near;
+	std::vector<body_handle> _promoted, _demoted;  // reused by update_tiers()
+	int _tier_steps = 0;  // steps since the last tier update
+
+	// async mode
+	std::thread _worker;
+	std::mutex _async_mutex;
+	std::condition_variable _async_cond;
+	btScalar _async_frame_time = 0;
+	bool _step_requested = false,
+		_stepping = false,
+		_quit = false;
+	uint64_t _async_frame = 0;
+	triple_buffer<world_snapshot> _snapshots;
 };
 
+template <typename... Args>
+body_handle world::create_body(Args &&... args)
+{
+	return _bodies.create(std::forward<Args>(args)...);
+}
+
 // helpers
 btTransform translate(btVector3 const & v);
 
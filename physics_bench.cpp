@@ -0,0 +1,448 @@
+// headless physics benchmark, recreates cube_rain workload without OGRE
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include "physics.hpp"
+
+using std::vector;
+using std::string, std::stoul, std::stoi, std::stod, std::to_string;
+using std::default_random_engine;
+using std::sort, std::accumulate;
+using std::cout, std::cerr, std::endl, std::setw, std::fixed, std::setprecision;
+using std::chrono::steady_clock, std::chrono::duration;
+using std::invalid_argument, std::out_of_range;
+
+constexpr size_t min_cube_count = 100,
+	max_cube_count = 100000;
+
+struct bench_options
+{
+	vector<size_t> cube_counts = {100, 1500, 10000};
+	size_t steps = 600;
+	size_t warmup_steps = 60;
+	unsigned seed = 42;
+	double time_step = 1.0/60.0;
+	int threads = 0;  // 0 for serial world
+	string scene_path;  // pre-settled scene files prefix, empty for no scenes
+	vector<physics::broadphase_type> broadphases = {physics::broadphase_type::dbvt};
+	bool box_culling = false;
+	bool particles = false;  // particle tier for isolated cubes
+};
+
+// same as cube_object in cube_rain, but without OGRE types
+struct cube_object
+{
+	btVector3 position;
+	btScalar scale;  // value between 0.7 and 1.4
+};
+
+struct step_statistics
+{
+	size_t cube_count;
+	size_t steps;
+	vector<double> step_times;  // in s
+	size_t collision_events;
+	double checksum;  // sum of final cube positions, to compare serial and multithreaded runs
+	physics::broadphase_type broadphase;
+};
+
+struct collision_counter : public physics::collision_listener
+{
+	size_t events = 0;
+
+	void on_collision(btCollisionObject * a, btCollisionObject * b) override
+	{
+		++events;
+	}
+
+	void on_separation(btCollisionObject * a, btCollisionObject * b) override
+	{
+		++events;
+	}
+};
+
+cube_object new_cube(default_random_engine & rand);
+physics::body_handle create_cube_body(physics::world & world, cube_object const & cube);
+btVector3 fall_velocity(cube_object const & cube);
+step_statistics run(size_t cube_count, physics::broadphase_type broadphase, bench_options const & opts);
+void print_header();
+void print(step_statistics & stats);
+void print_profile();
+double percentile(vector<double> const & sorted_samples, double p);
+bool parse_options(int argc, char * argv[], bench_options & opts);
+vector<size_t> parse_counts(string const & s);
+vector<physics::broadphase_type> parse_broadphases(string const & s);
+char const * to_string(physics::broadphase_type broadphase);
+
+
+step_statistics run(size_t cube_count, physics::broadphase_type broadphase, bench_options const & opts)
+{
+	default_random_engine rand{opts.seed};  // fixed seed, runs are comparable
+
+	physics::world_options world_opts;
+	world_opts.multithreaded = opts.threads > 0;
+	world_opts.thread_count = opts.threads;
+	world_opts.broadphase = broadphase;
+	world_opts.box_culling = opts.box_culling;
+	world_opts.particles.enabled = opts.particles;
+
+	physics::world world{world_opts};
+	world.native().setGravity(btVector3{0,0,0});  // turn off gravity as cube_rain does
+
+	collision_counter collisions;
+	world.subscribe_collisions(&collisions);
+
+	vector<cube_object> cubes(cube_count);
+	vector<physics::body_handle> cube_bodies(cube_count);
+
+	// pre-settled scene replaces warmup steps
+	string const scene_path = opts.scene_path.empty() ? string{} : opts.scene_path + "." + to_string(cube_count);
+	physics::world_checkpoint scene;
+	bool const scene_loaded = !scene_path.empty() && scene.load(scene_path) && size(scene.bodies) == cube_count;
+
+	if (scene_loaded)
+	{
+		cube_bodies = world.instantiate(scene);
+		for (size_t i = 0; i < cube_count; ++i)
+		{
+			physics::world_checkpoint::body_state const & s = scene.bodies[i];
+			cubes[i] = cube_object{btVector3{s.origin[0], s.origin[1], s.origin[2]}, s.shape_dims[0] / btScalar(0.5)};
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < cube_count; ++i)
+		{
+			cubes[i] = new_cube(rand);
+			cube_bodies[i] = create_cube_body(world, cubes[i]);
+		}
+		world.add_bodies(boost::make_iterator_range(cube_bodies.data(), cube_bodies.data() + cube_count));
+	}
+
+	// recycled cubes, reused between steps
+	vector<physics::body_handle> recycled_bodies;
+	vector<btTransform> recycled_transforms;
+	vector<btVector3> recycled_velocities;
+
+	step_statistics stats{cube_count, opts.steps, {}, 0, 0, broadphase};
+	stats.step_times.reserve(opts.steps);
+
+	constexpr btScalar fall_off_threshold = -10.0;
+
+	for (size_t step = scene_loaded ? opts.warmup_steps : 0; step < opts.warmup_steps + opts.steps; ++step)
+	{
+		if (step == opts.warmup_steps)
+		{
+			collisions.events = 0;
+
+			if (!scene_path.empty() && !scene_loaded)  // settled world for the next runs
+			{
+				world.checkpoint(scene);
+				if (!scene.save(scene_path))
+					cerr << "unable to save scene to '" << scene_path << "'" << endl;
+			}
+		}
+
+		steady_clock::time_point t0 = steady_clock::now();
+
+		world.simulate(opts.time_step);
+
+		// cube_rain::update() sync loop without scene nodes
+		recycled_bodies.clear();
+		recycled_transforms.clear();
+		recycled_velocities.clear();
+
+		auto cube_body_it = begin(cube_bodies);
+		for (cube_object & cube : cubes)
+		{
+			if (cube.position.y() > fall_off_threshold)
+				cube.position = world.transform(*cube_body_it).getOrigin();  // particles included
+			else  // reuse cubes too far from start position
+			{
+				cube = new_cube(rand);
+				recycled_bodies.push_back(*cube_body_it);
+				recycled_transforms.push_back(physics::translate(cube.position));
+				recycled_velocities.push_back(fall_velocity(cube));
+			}
+			++cube_body_it;
+		}
+
+		world.teleport_bodies(boost::make_iterator_range(recycled_bodies.data(),
+			recycled_bodies.data() + size(recycled_bodies)), recycled_transforms.data(), recycled_velocities.data());
+
+		duration<double> dt = steady_clock::now() - t0;
+		if (step >= opts.warmup_steps)
+			stats.step_times.push_back(dt.count());
+
+#ifdef PHYSICS_PROFILING
+		physics::profiler::get().end_frame();
+#endif
+	}
+
+	stats.collision_events = collisions.events;
+
+	for (cube_object const & cube : cubes)
+		stats.checksum += cube.position.x() + cube.position.y() + cube.position.z();
+
+	world.unsubscribe_collisions(&collisions);
+
+	return stats;
+}
+
+physics::body_handle create_cube_body(physics::world & world, cube_object const & cube)
+{
+	btScalar mass = 1;
+	physics::body_handle result = world.create_body(
+		world.shapes().box(btVector3{.5, .5, .5} * cube.scale),
+		physics::translate(cube.position),
+		mass);
+
+	world.get(result).rigid_body().setLinearVelocity(fall_velocity(cube));
+	return result;  // added to simulation by run()
+}
+
+btVector3 fall_velocity(cube_object const & cube)
+{
+	btScalar const fall_speed = 3 * (2.0 - cube.scale);
+	return btVector3{0, -fall_speed, 0};
+}
+
+//! cube_rain's new_cube() with explicit random engine
+cube_object new_cube(default_random_engine & rand)
+{
+	// generate three grid cube indices for 10x10x10 grid cube
+	constexpr unsigned size = 10;
+	unsigned i = rand() % size,
+		j = rand() % size,
+		k = rand() % size;
+
+	float x = (i - 0.5f*size) * (1.4f+1.f),  // from -7 to 7
+		y = (j + 7.f) * (1.4f+1.f),
+		z = (k - 0.5f*size) * (1.4f+1.f);
+
+	float scale = 0.7f + (rand() % 71)/100.f;  // scale between 0.7 and 0.7+0.7
+
+	return cube_object{btVector3{x, y, z}, scale};
+}
+
+void print_header()
+{
+	cout << setw(12) << "broadphase"
+		<< setw(8) << "cubes"
+		<< setw(8) << "steps"
+		<< setw(10) << "p50 ms"
+		<< setw(10) << "p90 ms"
+		<< setw(10) << "p99 ms"
+		<< setw(10) << "max ms"
+		<< setw(14) << "bodies/s"
+		<< setw(14) << "events/s"
+		<< setw(16) << "checksum" << "\n";
+}
+
+void print(step_statistics & stats)
+{
+	vector<double> & t = stats.step_times;
+	sort(begin(t), end(t));
+
+	double const total = accumulate(begin(t), end(t), 0.0);
+
+	cout << fixed
+		<< setw(12) << to_string(stats.broadphase)
+		<< setw(8) << stats.cube_count
+		<< setw(8) << stats.steps
+		<< setprecision(3)
+		<< setw(10) << percentile(t, 0.5) * 1e3
+		<< setw(10) << percentile(t, 0.9) * 1e3
+		<< setw(10) << percentile(t, 0.99) * 1e3
+		<< setw(10) << (t.empty() ? 0.0 : t.back()) * 1e3
+		<< setprecision(0)
+		<< setw(14) << (total > 0 ? stats.cube_count * stats.steps / total : 0.0)
+		<< setw(14) << (total > 0 ? stats.collision_events / total : 0.0)
+		<< setprecision(3)
+		<< setw(16) << stats.checksum << endl;
+}
+
+//! per phase split of the last steps (profile=1 build only)
+void print_profile()
+{
+#ifdef PHYSICS_PROFILING
+	for (physics::profiler::zone_stats const & z : physics::profiler::get().statistics())
+	{
+		cout << "  " << setw(36) << z.name << setprecision(3)
+			<< setw(10) << z.p50 << setw(10) << z.p90 << setw(10) << z.p99
+			<< (z.counter ? "" : " ms") << "\n";
+	}
+#endif
+}
+
+//! nearest-rank percentile, p in [0, 1]
+double percentile(vector<double> const & sorted_samples, double p)
+{
+	if (sorted_samples.empty())
+		return 0;
+
+	size_t idx = static_cast<size_t>(p * (size(sorted_samples) - 1) + 0.5);
+	return sorted_samples[idx];
+}
+
+vector<size_t> parse_counts(string const & s)
+{
+	vector<size_t> result;
+	size_t pos = 0;
+	while (pos < size(s))
+	{
+		size_t comma = s.find(',', pos);
+		if (comma == string::npos)
+			comma = size(s);
+
+		size_t const count = stoul(s.substr(pos, comma - pos));
+		if (count < min_cube_count || count > max_cube_count)
+			return {};  // out of supported range
+
+		result.push_back(count);
+		pos = comma + 1;
+	}
+	return result;
+}
+
+vector<physics::broadphase_type> parse_broadphases(string const & s)
+{
+	vector<physics::broadphase_type> result;
+	size_t pos = 0;
+	while (pos < size(s))
+	{
+		size_t comma = s.find(',', pos);
+		if (comma == string::npos)
+			comma = size(s);
+
+		string const name = s.substr(pos, comma - pos);
+		if (name == "dbvt")
+			result.push_back(physics::broadphase_type::dbvt);
+		else if (name == "axis_sweep")
+			result.push_back(physics::broadphase_type::axis_sweep);
+		else if (name == "grid")
+			result.push_back(physics::broadphase_type::grid);
+		else
+			return {};  // unknown broadphase
+
+		pos = comma + 1;
+	}
+	return result;
+}
+
+char const * to_string(physics::broadphase_type broadphase)
+{
+	switch (broadphase)
+	{
+		case physics::broadphase_type::dbvt: return "dbvt";
+		case physics::broadphase_type::axis_sweep: return "axis_sweep";
+		case physics::broadphase_type::grid: return "grid";
+	}
+	return "unknown";
+}
+
+//! \return false for unknown option or malformed value
+bool parse_options(int argc, char * argv[], bench_options & opts)
+{
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			string arg = argv[i];
+			if (arg == "--help" || i+1 == argc)
+				return false;
+
+			string value = argv[++i];
+			if (arg == "--cubes")
+			{
+				opts.cube_counts = parse_counts(value);
+				if (opts.cube_counts.empty())
+					return false;
+			}
+			else if (arg == "--steps")
+				opts.steps = stoul(value);
+			else if (arg == "--warmup")
+				opts.warmup_steps = stoul(value);
+			else if (arg == "--seed")
+				opts.seed = stoul(value);
+			else if (arg == "--dt")
+				opts.time_step = stod(value);
+			else if (arg == "--threads")
+				opts.threads = stoi(value);
+			else if (arg == "--scene")
+				opts.scene_path = value;
+			else if (arg == "--box-culling")
+				opts.box_culling = stoi(value) != 0;
+			else if (arg == "--particles")
+				opts.particles = stoi(value) != 0;
+			else if (arg == "--broadphase")
+			{
+				opts.broadphases = parse_broadphases(value);
+				if (opts.broadphases.empty())
+					return false;
+			}
+			else
+				return false;
+		}
+		return true;
+	}
+	catch (invalid_argument const &)  // stoi(), stoul() and stod() failures
+	{
+		return false;
+	}
+	catch (out_of_range const &)
+	{
+		return false;
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	bench_options opts;
+	if (!parse_options(argc, argv, opts))
+	{
+		cerr << "usage: physics_bench [--cubes N[,N...]] [--steps N] [--warmup N] [--seed N] [--dt SECONDS] [--threads N] [--scene PREFIX]\n"
+			<< "  [--broadphase NAME[,NAME...]] [--box-culling 0|1] [--particles 0|1]\n"
+			<< "  --cubes   cube counts to measure (default 100,1500,10000, from 100 up to 100000)\n"
+			<< "  --steps   measured simulation steps per cube count (default 600)\n"
+			<< "  --warmup  steps simulated before measuring (default 60)\n"
+			<< "  --seed    random engine seed (default 42)\n"
+			<< "  --dt      simulation time step (default 1/60 s)\n"
+			<< "  --threads multithreaded world with N threads, 0 for serial world (default 0)\n"
+			<< "  --scene   pre-settled world checkpoint PREFIX.N per cube count, saved after warmup if missing,\n"
+			<< "            loaded instead of warmup otherwise\n"
+			<< "  --broadphase broadphases to compare: dbvt, axis_sweep, grid (default dbvt), build with profile=1\n"
+			<< "            to see pair finding time (calculateOverlappingPairs zone)\n"
+			<< "  --box-culling batched SAT culling of separated box pairs before narrowphase (default 0)\n"
+			<< "  --particles simulate isolated cubes as particles outside of Bullet (default 0)\n";
+		return 1;
+	}
+
+	PHYSICS_PROFILE_THREAD("bench");
+#ifdef PHYSICS_PROFILING
+	physics::profiler::get().hook_bullet();
+#endif
+
+	cout << "seed: " << opts.seed << ", time step: " << opts.time_step << " s, threads: " << opts.threads
+		<< ", box culling: " << opts.box_culling << ", particles: " << opts.particles << "\n";
+	print_header();
+
+	for (physics::broadphase_type broadphase : opts.broadphases)
+	{
+		for (size_t cube_count : opts.cube_counts)
+		{
+			step_statistics stats = run(cube_count, broadphase, opts);
+			print(stats);
+			print_profile();
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+#include <cassert>
+#include <bullet/LinearMath/btQuickprof.h>
+#include "profiler.hpp"
+
+using std::vector, std::string;
+using std::lock_guard, std::mutex;
+using std::ofstream, std::ostream;
+using std::sort, std::min;
+using std::memory_order_relaxed, std::memory_order_acquire, std::memory_order_release;
+
+namespace physics {
+
+namespace {
+
+constexpr int max_depth = 32;
+
+//! per thread zone stack
+struct thread_state
+{
+	int thread = -1;  // attached thread index, -1 for not measured thread
+	int depth = 0;
+	uint16_t zones[max_depth];
+	int64_t begins[max_depth];  // in ns
+};
+
+thread_local thread_state this_thread;
+
+void bullet_enter(char const * name)
+{
+	profiler::get().enter(name);
+}
+
+void bullet_leave()
+{
+	profiler::get().leave();
+}
+
+}  // namespace
+
+profiler & profiler::get()
+{
+	static profiler p;
+	return p;
+}
+
+profiler::profiler()
+	: _epoch{clock::now()}
+{}
+
+void profiler::attach_thread(char const * name)
+{
+	lock_guard<mutex> lock{_trace_mutex};
+	this_thread.thread = static_cast<int>(size(_thread_names));
+	_thread_names.push_back(name);
+}
+
+void profiler::hook_bullet()
+{
+	btSetCustomEnterProfileZoneFunc(bullet_enter);
+	btSetCustomLeaveProfileZoneFunc(bullet_leave);
+}
+
+void profiler::enter(char const * name)
+{
+	thread_state & ts = this_thread;
+	if (ts.thread < 0)
+		return;
+
+	if (ts.depth < max_depth)
+	{
+		ts.zones[ts.depth] = zone_index(name, false);
+		ts.begins[ts.depth] = (clock::now() - _epoch).count();
+	}
+	++ts.depth;
+}
+
+void profiler::leave()
+{
+	thread_state & ts = this_thread;
+	if (ts.thread < 0 || ts.depth == 0)
+		return;
+
+	--ts.depth;
+	if (ts.depth >= max_depth)
+		return;
+
+	int64_t const end = (clock::now() - _epoch).count();
+	int64_t const begin = ts.begins[ts.depth];
+	uint16_t const idx = ts.zones[ts.depth];
+
+	zone & z = _zones[idx];
+	z.value.fetch_add(end - begin, memory_order_relaxed);
+	z.calls.fetch_add(1, memory_order_relaxed);
+
+	if (capturing())
+	{
+		lock_guard<mutex> lock{_trace_mutex};
+		_trace.push_back(trace_event{idx, static_cast<uint16_t>(ts.thread), begin, end});
+	}
+}
+
+void profiler::count(char const * name, int64_t value)
+{
+	zone & z = _zones[zone_index(name, true)];
+	z.value.fetch_add(value, memory_order_relaxed);
+	z.calls.fetch_add(1, memory_order_relaxed);
+}
+
+uint16_t profiler::zone_index(char const * name, bool counter)
+{
+	size_t n = _zone_count.load(memory_order_acquire);
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (_zones[i].name == name)
+			return static_cast<uint16_t>(i);
+	}
+
+	// new zone
+	lock_guard<mutex> lock{_zone_mutex};
+	n = _zone_count.load(memory_order_relaxed);
+	for (size_t i = 0; i < n; ++i)  // registered in between
+	{
+		if (_zones[i].name == name)
+			return static_cast<uint16_t>(i);
+	}
+
+	assert(n < max_zones && "too many profiler zones");
+	if (n == max_zones)
+		return max_zones - 1;  // merged with the last one
+
+	_zones[n].name = name;
+	_zones[n].counter = counter;
+	_zone_count.store(n + 1, memory_order_release);
+	return static_cast<uint16_t>(n);
+}
+
+void profiler::end_frame()
+{
+	size_t const n = _zone_count.load(memory_order_acquire);
+	size_t const slot = _frame % history_size;
+	int64_t const now = (clock::now() - _epoch).count();
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		zone & z = _zones[i];
+		int64_t const value = z.value.exchange(0, memory_order_relaxed);
+		z.last_calls = static_cast<size_t>(z.calls.exchange(0, memory_order_relaxed));
+		z.history[slot] = z.counter ? static_cast<float>(value) : value * 1e-6f;  // ns -> ms
+
+		if (z.counter && capturing())
+		{
+			lock_guard<mutex> lock{_trace_mutex};
+			_trace.push_back(trace_event{static_cast<uint16_t>(i), 0, now, value});  // end is counter value
+		}
+	}
+
+	++_frame;
+
+	if (capturing() && _capture_frames.fetch_sub(1) == 1)  // the last captured frame
+	{
+		lock_guard<mutex> lock{_trace_mutex};
+		ofstream fout{_capture_path};
+		write_chrome_trace(fout);
+		_trace.clear();
+	}
+}
+
+vector<profiler::zone_stats> const & profiler::statistics()
+{
+	size_t const n = _zone_count.load(memory_order_acquire);
+	size_t const frames = min(_frame, history_size);
+
+	_stats.clear();
+	if (frames == 0)
+		return _stats;
+
+	auto percentile = [this](double p){
+		return static_cast<double>(_sorted[static_cast<size_t>(p * (size(_sorted) - 1) + 0.5)]);
+	};
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		zone const & z = _zones[i];
+		_sorted.assign(begin(z.history), begin(z.history) + frames);
+		sort(begin(_sorted), end(_sorted));
+
+		_stats.push_back(zone_stats{z.name, z.counter, z.last_calls,
+			z.history[(_frame - 1) % history_size], percentile(0.5), percentile(0.9), percentile(0.99)});
+	}
+
+	return _stats;
+}
+
+void profiler::capture_trace(size_t frames, string const & path)
+{
+	lock_guard<mutex> lock{_trace_mutex};
+	_trace.clear();
+	_capture_path = path;
+	_capture_frames.store(frames);
+}
+
+//! Chrome trace event format (chrome://tracing, ui.perfetto.dev), zones as complete (X) events
+void profiler::write_chrome_trace(ostream & out) const
+{
+	out << "{\"traceEvents\":[\n";
+
+	bool first = true;
+	for (size_t i = 0; i < size(_thread_names); ++i)
+	{
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+			<< ",\"args\":{\"name\":\"" << _thread_names[i] << "\"}}";
+		first = false;
+	}
+
+	for (trace_event const & e : _trace)
+	{
+		zone const & z = _zones[e.zone];
+		out << (first ? "" : ",\n");
+		first = false;
+
+		if (z.counter)
+		{
+			out << "{\"name\":\"" << z.name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << e.begin / 1e3
+				<< ",\"args\":{\"value\":" << e.end << "}}";
+		}
+		else
+		{
+			out << "{\"name\":\"" << z.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+				<< ",\"ts\":" << e.begin / 1e3 << ",\"dur\":" << (e.end - e.begin) / 1e3 << "}";
+		}
+	}
+
+	out << "\n]}\n";
+}
+
+}  // physics
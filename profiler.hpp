@@ -0,0 +1,136 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+#include <cstddef>
+
+/*! Profiling macros, compiled out without PHYSICS_PROFILING define (see `scons profile=1`).
+\code
+void world::handle_collisions()
+{
+	PHYSICS_PROFILE_SCOPE("handle_collisions");
+	...
+	PHYSICS_PROFILE_COUNTER("manifolds", _dispatcher->getNumManifolds());
+}
+\endcode */
+#ifdef PHYSICS_PROFILING
+	#define PHYSICS_PROFILE_CONCAT_(a, b) a##b
+	#define PHYSICS_PROFILE_CONCAT(a, b) PHYSICS_PROFILE_CONCAT_(a, b)
+	#define PHYSICS_PROFILE_SCOPE(name) physics::profile_scope PHYSICS_PROFILE_CONCAT(_profile_scope_, __LINE__){name}
+	#define PHYSICS_PROFILE_COUNTER(name, value) physics::profiler::get().count(name, value)
+	#define PHYSICS_PROFILE_THREAD(name) physics::profiler::get().attach_thread(name)
+#else
+	#define PHYSICS_PROFILE_SCOPE(name)
+	#define PHYSICS_PROFILE_COUNTER(name, value)
+	#define PHYSICS_PROFILE_THREAD(name)
+#endif
+
+namespace physics {
+
+/*! Frame profiler with scoped zones and counters.
+
+Zones are accumulated per frame (end_frame()) and kept for the last `history_size` frames to get
+rolling percentiles. Only zones entered from attached threads are measured (e.g. Bullet worker
+threads are ignored), zone and counter names needs to be string literals (compared by address).
+Bullet internal zones (BT_PROFILE) are measured after hook_bullet() call.
+\code
+profiler & prof = profiler::get();
+prof.attach_thread("main");
+prof.hook_bullet();
+while (running)
+{
+	{
+		profile_scope s{"update"};
+		update();
+	}
+	prof.end_frame();
+}
+prof.capture_trace(120, "trace.json");  // next 120 frames to Chrome trace file (chrome://tracing)
+\endcode
+\note zone enter/leave is lock-free, end_frame() and statistics needs to be called from one thread */
+class profiler
+{
+public:
+	static constexpr size_t max_zones = 64;
+	static constexpr size_t history_size = 240;  //!< frames
+
+	struct zone_stats
+	{
+		char const * name;
+		bool counter;  //!< counter value or zone time
+		size_t calls;  //!< in the last frame
+		double last, p50, p90, p99;  //!< ms for zones
+	};
+
+	static profiler & get();
+
+	void attach_thread(char const * name);  //!< measure zones from the calling thread
+	void hook_bullet();  //!< measure Bullet BT_PROFILE zones
+
+	void enter(char const * name);
+	void leave();
+	void count(char const * name, int64_t value);  //!< adds value to the frame counter
+
+	void end_frame();  //!< closes frame statistics (and trace capture frame)
+	std::vector<zone_stats> const & statistics();  //!< zones and counters from the last frames
+
+	//! captures zones of the next `frames` frames, Chrome trace JSON is written to `path` after that
+	void capture_trace(size_t frames, std::string const & path);
+	bool capturing() const {return _capture_frames > 0;}
+	void write_chrome_trace(std::ostream & out) const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct zone
+	{
+		char const * name = nullptr;
+		bool counter = false;
+		std::atomic<int64_t> value{0};  // frame time in ns or counter value
+		std::atomic<int64_t> calls{0};
+		std::array<float, history_size> history = {};  // per frame values (ms for zones)
+		size_t last_calls = 0;
+	};
+
+	struct trace_event
+	{
+		uint16_t zone;
+		uint16_t thread;
+		int64_t begin, end;  // ns from _epoch
+	};
+
+	profiler();
+	uint16_t zone_index(char const * name, bool counter);
+
+	clock::time_point const _epoch;
+	std::array<zone, max_zones> _zones;
+	std::atomic<size_t> _zone_count{0};
+	std::mutex _zone_mutex;  // new zone registration only
+	size_t _frame = 0;
+	std::vector<zone_stats> _stats;
+	std::vector<float> _sorted;  // percentile scratch buffer
+
+	// trace capture
+	std::atomic<size_t> _capture_frames{0};
+	std::string _capture_path;
+	std::mutex _trace_mutex;
+	std::vector<trace_event> _trace;
+	std::vector<std::string> _thread_names;
+};
+
+//! measures scope as profiler zone
+class profile_scope
+{
+public:
+	explicit profile_scope(char const * name) {profiler::get().enter(name);}
+	~profile_scope() {profiler::get().leave();}
+	profile_scope(profile_scope const &) = delete;
+	profile_scope & operator=(profile_scope const &) = delete;
+};
+
+}  // physics
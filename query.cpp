@@ -0,0 +1,352 @@
+// world spatial queries implementation
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include "physics.hpp"
+
+using std::vector, std::size, std::max;
+using std::make_unique;
+using std::sqrt;
+
+namespace physics {
+
+constexpr int query_grain = 64;  // queries per task
+
+//! calls `f(leaf)` for all leaves overlapping `volume` of all `trees`, `stack` is reused between calls
+template <typename F>
+static void collide(vector<btDbvt const *> const & trees, btDbvtVolume const & volume,
+	vector<btDbvtNode const *> & stack, F && f)
+{
+	stack.clear();
+	for (btDbvt const * tree : trees)
+		if (tree->m_root)
+			stack.push_back(tree->m_root);
+
+	while (!stack.empty())
+	{
+		btDbvtNode const * node = stack.back();
+		stack.pop_back();
+
+		if (!Intersect(node->volume, volume))
+			continue;
+
+		if (node->isinternal())
+		{
+			stack.push_back(node->childs[0]);
+			stack.push_back(node->childs[1]);
+		}
+		else
+			f(node);
+	}
+}
+
+/*! query tree leaf data, btDbvtBroadphase leaves points to btDbvtProxy (btBroadphaseProxy is its only base)
+and _query_tree leaves to btBroadphaseProxy */
+static btBroadphaseProxy const & leaf_proxy(btDbvtNode const * leaf)
+{
+	return *static_cast<btBroadphaseProxy const *>(leaf->data);
+}
+
+//! squared distance of point p from volume (zero for p inside)
+static btScalar distance2(btVector3 const & p, btDbvtVolume const & volume)
+{
+	btScalar d2 = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		btScalar const d = max({volume.Mins()[i] - p[i], p[i] - volume.Maxs()[i], btScalar(0)});
+		d2 += d*d;
+	}
+	return d2;
+}
+
+//! btIParallelForBody adapter for lambdas
+template <typename F>
+struct parallel_for_body : public btIParallelForBody
+{
+	F const & f;
+
+	explicit parallel_for_body(F const & f)
+		: f{f}
+	{}
+
+	void forLoop(int first, int last) const override
+	{
+		f(first, last);
+	}
+};
+
+//! exact (shape) ray test of leaf bodies, keeps the closest hit
+struct ray_collider : public btDbvt::ICollide
+{
+	btTransform const from, to;
+	btCollisionWorld::ClosestRayResultCallback & result;
+
+	ray_collider(ray const & r, btCollisionWorld::ClosestRayResultCallback & result)
+		: from{btQuaternion::getIdentity(), r.from}
+		, to{btQuaternion::getIdentity(), r.to}
+		, result{result}
+	{}
+
+	void Process(btDbvtNode const * leaf) override
+	{
+		btBroadphaseProxy const & proxy = leaf_proxy(leaf);
+		if ((proxy.m_collisionFilterGroup & result.m_collisionFilterMask)
+			&& (result.m_collisionFilterGroup & proxy.m_collisionFilterMask))
+		{
+			auto * o = static_cast<btCollisionObject *>(proxy.m_clientObject);
+			btCollisionWorld::rayTestSingle(from, to, o, o->getCollisionShape(), o->getWorldTransform(), result);
+		}
+	}
+};
+
+void world::raycast_batch(ray_range rays, ray_hit * hits, int groups)
+{
+	PHYSICS_PROFILE_SCOPE("raycast_batch");
+	update_query_snapshot();
+
+	auto cast = [this, &rays, hits, groups](int first, int last){
+		thread_local btAlignedObjectArray<btDbvtNode const *> stack;  // reused by pool threads, tree is shared read-only
+
+		for (int i = first; i < last; ++i)
+		{
+			ray const & r = rays[i];
+			btCollisionWorld::ClosestRayResultCallback result{r.from, r.to};
+			result.m_collisionFilterGroup = btBroadphaseProxy::AllFilter;
+			result.m_collisionFilterMask = groups;
+
+			btVector3 const dir = r.to - r.from;
+			if (dir.length2() > 0)
+			{
+				btVector3 const n = dir.normalized();
+				btVector3 inv_dir;
+				unsigned signs[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					inv_dir[k] = n[k] == 0 ? BT_LARGE_FLOAT : 1 / n[k];
+					signs[k] = inv_dir[k] < 0;
+				}
+
+				ray_collider collider{r, result};
+				for (btDbvt const * tree : _query_trees)
+				{
+					if (tree->m_root)
+					{
+						tree->rayTestInternal(tree->m_root, r.from, r.to, inv_dir, signs, n.dot(dir),
+							btVector3{0, 0, 0}, btVector3{0, 0, 0}, stack, collider);
+					}
+				}
+			}
+
+			if (result.hasHit())
+			{
+				hits[i] = ray_hit{result.m_collisionObject, result.m_hitPointWorld, result.m_hitNormalWorld,
+					result.m_closestHitFraction};
+			}
+			else
+				hits[i] = ray_hit{nullptr, r.to, btVector3{0, 0, 0}, 1};
+		}
+	};
+
+	query_scheduler().parallelFor(0, static_cast<int>(rays.size()), query_grain,
+		parallel_for_body<decltype(cast)>{cast});
+}
+
+void world::query_aabb(aabb_range boxes, query_result & result, int groups)
+{
+	PHYSICS_PROFILE_SCOPE("query_aabb");
+	update_query_snapshot();
+
+	result.objects.clear();
+	result.distances.clear();
+	result.offsets.resize(boxes.size() + 1);
+
+	size_t i = 0;
+	for (aabb const & box : boxes)
+	{
+		result.offsets[i++] = static_cast<uint32_t>(size(result.objects));
+		collide(_query_trees, btDbvtVolume::FromMM(box.min, box.max), _query_stack,
+			[&result, &box, groups](btDbvtNode const * leaf){
+				btBroadphaseProxy const & proxy = leaf_proxy(leaf);  // broadphase leaf volumes are enlarged
+				if ((proxy.m_collisionFilterGroup & groups)
+					&& TestAabbAgainstAabb2(proxy.m_aabbMin, proxy.m_aabbMax, box.min, box.max))
+				{
+					result.objects.push_back(static_cast<btCollisionObject const *>(proxy.m_clientObject));
+				}
+			});
+	}
+	result.offsets[i] = static_cast<uint32_t>(size(result.objects));
+}
+
+void world::nearest_k(point_range points, size_t k, query_result & result, int groups)
+{
+	PHYSICS_PROFILE_SCOPE("nearest_k");
+	update_query_snapshot();
+
+	// k slots per point (sorted by squared distance), compacted after search
+	size_t const point_count = points.size();
+	result.objects.assign(point_count * k, nullptr);
+	result.distances.assign(point_count * k, BT_LARGE_FLOAT);
+	result.offsets.resize(point_count + 1);
+
+	auto search = [this, &points, k, &result, groups](int first, int last){
+		thread_local vector<btDbvtNode const *> stack;  // reused by pool threads
+
+		for (int i = first; i < last; ++i)
+		{
+			btVector3 const & p = points[i];
+			btCollisionObject const ** best = result.objects.data() + k*i;
+			btScalar * best_d2 = result.distances.data() + k*i;
+			size_t found = 0;
+
+			stack.clear();
+			for (btDbvt const * tree : _query_trees)
+				if (tree->m_root && k > 0)
+					stack.push_back(tree->m_root);
+
+			// depth first, nearer child first, subtrees farther than the k-th body are skipped
+			while (!stack.empty())
+			{
+				btDbvtNode const * node = stack.back();
+				stack.pop_back();
+
+				if (found == k && distance2(p, node->volume) >= best_d2[k-1])
+					continue;
+
+				if (node->isinternal())
+				{
+					bool const first_nearer = distance2(p, node->childs[0]->volume) <= distance2(p, node->childs[1]->volume);
+					stack.push_back(node->childs[first_nearer ? 1 : 0]);
+					stack.push_back(node->childs[first_nearer ? 0 : 1]);
+					continue;
+				}
+
+				btBroadphaseProxy const & proxy = leaf_proxy(node);
+				if (!(proxy.m_collisionFilterGroup & groups))
+					continue;
+
+				auto const * o = static_cast<btCollisionObject const *>(proxy.m_clientObject);
+				btScalar const d2 = (o->getWorldTransform().getOrigin() - p).length2();
+				if (found == k && d2 >= best_d2[k-1])
+					continue;
+
+				// insertion into sorted slots
+				size_t j = found < k ? found++ : k - 1;
+				for (; j > 0 && best_d2[j-1] > d2; --j)
+				{
+					best[j] = best[j-1];
+					best_d2[j] = best_d2[j-1];
+				}
+				best[j] = o;
+				best_d2[j] = d2;
+			}
+		}
+	};
+
+	query_scheduler().parallelFor(0, static_cast<int>(point_count), query_grain,
+		parallel_for_body<decltype(search)>{search});
+
+	// compaction, empty slots are at the end of each point slots
+	size_t pos = 0;
+	for (size_t i = 0; i < point_count; ++i)
+	{
+		result.offsets[i] = static_cast<uint32_t>(pos);
+		for (size_t j = k*i; j < k*(i+1) && result.objects[j]; ++j, ++pos)
+		{
+			result.objects[pos] = result.objects[j];
+			result.distances[pos] = sqrt(result.distances[j]);
+		}
+	}
+	result.offsets[point_count] = static_cast<uint32_t>(pos);
+	result.objects.resize(pos);
+	result.distances.resize(pos);
+}
+
+query_result::object_range query_result::operator[](size_t query) const
+{
+	assert(query < query_count());
+	btCollisionObject const * const * data = objects.data();
+	return object_range{data + offsets[query], data + offsets[query + 1]};
+}
+
+/*! Query trees of all bodies in simulation (particles included). With btDbvtBroadphase its trees are
+queried directly (world is idle, so they are up to date) and only particles go into _query_tree. Leaves
+of _query_tree are kept between updates, changed ones are reinserted (btDbvt reuses the freed node), so
+update does not allocate in steady state. */
+void world::update_query_snapshot()
+{
+	if (_query_snapshot_valid)
+		return;
+
+	PHYSICS_PROFILE_SCOPE("update_query_snapshot");
+
+	_query_snapshot_valid = true;
+	size_t leaf_count = 0;
+	auto set_leaf = [this, &leaf_count](btBroadphaseProxy * proxy){
+		btDbvtVolume volume = btDbvtVolume::FromMM(proxy->m_aabbMin, proxy->m_aabbMax);
+		if (leaf_count < size(_query_leaves))
+		{
+			btDbvtNode * leaf = _query_leaves[leaf_count];
+			leaf->data = proxy;
+			if (NotEqual(leaf->volume, volume))
+				_query_tree.update(leaf, volume);
+		}
+		else
+			_query_leaves.push_back(_query_tree.insert(volume, proxy));
+		++leaf_count;
+	};
+
+	_query_trees.clear();
+	if (_broadphase_type == broadphase_type::dbvt)
+	{
+		btDbvtBroadphase const & dbvt = static_cast<btDbvtBroadphase const &>(*_broadphase);
+		_query_trees.push_back(&dbvt.m_sets[0]);  // dynamic
+		_query_trees.push_back(&dbvt.m_sets[1]);  // fixed
+	}
+	else
+	{
+		btCollisionObjectArray & colls = _world->getCollisionObjectArray();
+		for (int i = 0; i < size(colls); ++i)
+			if (btBroadphaseProxy * proxy = colls[i]->getBroadphaseHandle())
+				set_leaf(proxy);
+	}
+
+	// particle bodies are kept at particle position by step_particles(), so exact ray test works for them
+	_particle_proxies.resize(_particles.size());
+	for (uint32_t idx = 0; idx < _particles.size(); ++idx)
+	{
+		body & b = get(_particles.handle(idx));
+		btVector3 const p = _particles.position(idx),
+			r{_particles.radius(idx), _particles.radius(idx), _particles.radius(idx)};
+
+		btBroadphaseProxy & proxy = _particle_proxies[idx];
+		proxy.m_clientObject = &b.rigid_body();
+		// Bullet filter defaults for dynamic body
+		proxy.m_collisionFilterGroup = b.has_collision_filter() ? b.collision_group() : int{btBroadphaseProxy::DefaultFilter};
+		proxy.m_collisionFilterMask = b.has_collision_filter() ? b.collision_mask() : int{btBroadphaseProxy::AllFilter};
+		proxy.m_aabbMin = p - r;
+		proxy.m_aabbMax = p + r;
+		set_leaf(&proxy);
+	}
+
+	// leaves of removed bodies and particles
+	while (size(_query_leaves) > leaf_count)
+	{
+		_query_tree.remove(_query_leaves.back());
+		_query_leaves.pop_back();
+	}
+
+	_query_trees.push_back(&_query_tree);
+}
+
+btITaskScheduler & world::query_scheduler()
+{
+	if (!_query_scheduler)  // serial world without world_options::scheduler, threads are created for queries only
+	{
+		_scheduler = make_unique<task_scheduler>();
+		_query_scheduler = _scheduler.get();
+	}
+	return *_query_scheduler;
+}
+
+}  // physics
@@ -0,0 +1,114 @@
+#include <utility>
+#include <cmath>
+#include <cassert>
+#include "shape_cache.hpp"
+
+using std::swap, std::move;
+using std::make_unique;
+using std::lround;
+
+namespace physics {
+
+static int32_t quantize(btScalar v)
+{
+	return static_cast<int32_t>(lround(v / shape_cache::quantum));
+}
+
+static btScalar dequantize(int32_t q)
+{
+	return q * shape_cache::quantum;
+}
+
+shape_cache::shape_ref::shape_ref(shape_cache * cache, entry * e)
+	: _cache{cache}
+	, _entry{e}
+{
+	++_entry->refs;
+}
+
+shape_cache::shape_ref::shape_ref(shape_ref const & other)
+	: _cache{other._cache}
+	, _entry{other._entry}
+{
+	if (_entry)
+		++_entry->refs;
+}
+
+shape_cache::shape_ref::shape_ref(shape_ref && other)
+	: _cache{other._cache}
+	, _entry{other._entry}
+{
+	other._cache = nullptr;
+	other._entry = nullptr;
+}
+
+shape_cache::shape_ref::~shape_ref()
+{
+	if (_entry)
+		_cache->release(_entry);
+}
+
+shape_cache::shape_ref & shape_cache::shape_ref::operator=(shape_ref other)
+{
+	swap(_cache, other._cache);
+	swap(_entry, other._entry);
+	return *this;
+}
+
+btCollisionShape * shape_cache::shape_ref::get() const
+{
+	return _entry ? _entry->shape.get() : nullptr;
+}
+
+shape_cache::shape_ref shape_cache::box(btVector3 const & half_extents)
+{
+	key const k{BOX_SHAPE_PROXYTYPE,
+		{quantize(half_extents.x()), quantize(half_extents.y()), quantize(half_extents.z())}};
+
+	return intern(k, [&k]{
+		return make_unique<btBoxShape>(
+			btVector3{dequantize(k.dims[0]), dequantize(k.dims[1]), dequantize(k.dims[2])});
+	});
+}
+
+shape_cache::shape_ref shape_cache::sphere(btScalar radius)
+{
+	key const k{SPHERE_SHAPE_PROXYTYPE, {quantize(radius), 0, 0}};
+
+	return intern(k, [&k]{
+		return make_unique<btSphereShape>(dequantize(k.dims[0]));
+	});
+}
+
+template <typename Create>
+shape_cache::shape_ref shape_cache::intern(key const & k, Create && create)
+{
+	auto it = _shapes.find(k);
+	if (it == end(_shapes))
+		it = _shapes.emplace(k, entry{k, create(), 0}).first;
+
+	return shape_ref{this, &it->second};
+}
+
+void shape_cache::release(entry * e)
+{
+	assert(e->refs > 0);
+	if (--e->refs == 0)
+		_shapes.erase(e->k);
+}
+
+bool shape_cache::key::operator==(key const & other) const
+{
+	return type == other.type && dims[0] == other.dims[0] && dims[1] == other.dims[1]
+		&& dims[2] == other.dims[2];
+}
+
+size_t shape_cache::key_hash::operator()(key const & k) const
+{
+	size_t h = static_cast<size_t>(k.type);
+	for (int32_t d : k.dims)
+		h = h * 0x100000001b3ull ^ static_cast<uint32_t>(d);
+	return h;
+}
+
+}  // physics
@@ -0,0 +1,88 @@
+#pragma once
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <bullet/BulletCollision/btBulletCollisionCommon.h>
+
+namespace physics {
+
+/*! Shared collision shapes interned by shape type and quantized dimensions.
+
+Bodies with (nearly) the same dimensions share one shape instance. Shapes are reference counted
+and destroyed with the last reference.
+\code
+shape_cache shapes;
+shape_cache::shape_ref a = shapes.box(btVector3{.5, .5, .5}),
+	b = shapes.box(btVector3{.5, .5, .5});
+assert(a.get() == b.get());
+\endcode
+\note cache needs to outlive all references, not thread safe */
+class shape_cache
+{
+	struct entry;
+
+public:
+	static constexpr btScalar quantum = btScalar(1) / 1024;  //!< dimensions resolution
+
+	//! counted reference to a cached shape
+	class shape_ref
+	{
+	public:
+		shape_ref() = default;
+		shape_ref(shape_ref const & other);
+		shape_ref(shape_ref && other);
+		~shape_ref();
+		shape_ref & operator=(shape_ref other);
+
+		btCollisionShape * get() const;
+		btCollisionShape * operator->() const {return get();}
+		explicit operator bool() const {return _entry != nullptr;}
+
+	private:
+		shape_ref(shape_cache * cache, entry * e);
+
+		shape_cache * _cache = nullptr;
+		entry * _entry = nullptr;
+
+		friend class shape_cache;
+	};
+
+	shape_cache() = default;
+	shape_cache(shape_cache const &) = delete;
+	shape_cache & operator=(shape_cache const &) = delete;
+
+	shape_ref box(btVector3 const & half_extents);
+	shape_ref sphere(btScalar radius);
+
+	size_t size() const {return _shapes.size();}  //!< number of distinct shapes
+
+private:
+	struct key
+	{
+		int type;  //!< BroadphaseNativeTypes value
+		int32_t dims[3];  //!< quantized dimensions
+
+		bool operator==(key const & other) const;
+	};
+
+	struct key_hash
+	{
+		size_t operator()(key const & k) const;
+	};
+
+	struct entry
+	{
+		key k;
+		std::unique_ptr<btCollisionShape> shape;
+		size_t refs;
+	};
+
+	template <typename Create>
+	shape_ref intern(key const & k, Create && create);
+	void release(entry * e);
+
+	std::unordered_map<key, entry, key_hash> _shapes;  // node based, entry addresses are stable
+};
+
+}  // physics
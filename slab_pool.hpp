@@ -0,0 +1,186 @@
+#pragma once
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+namespace physics {
+
+//! stable reference to an object in slab_pool
+struct slab_handle
+{
+	static constexpr uint32_t invalid_index = ~0u;
+
+	uint32_t index = invalid_index;  //!< pool slot index
+	uint32_t generation = 0;  //!< slot generation, handle to destroyed object does not match
+
+	explicit operator bool() const {return index != invalid_index;}
+};
+
+inline bool operator==(slab_handle a, slab_handle b)
+{
+	return a.index == b.index && a.generation == b.generation;
+}
+
+inline bool operator!=(slab_handle a, slab_handle b)
+{
+	return !(a == b);
+}
+
+/*! Slab allocator with stable handles.
+
+Objects are constructed in place inside fixed sized chunks (allocated once with `alignof(T)` alignment
+and never moved), so creating and destroying objects does not cost any per-object allocation and
+objects created together are next to each other in memory. Destroyed slots are reused (LIFO).
+\code
+slab_pool<body> pool;
+slab_handle h = pool.create(btVector3{.5, .5, .5}, translate(btVector3{0, 10, 0}), 1);
+pool.get(h)->rigid_body().setLinearVelocity(btVector3{0, -1, 0});
+pool.destroy(h);
+\endcode */
+template <typename T, size_t ChunkSize = 256>
+class slab_pool
+{
+public:
+	static constexpr size_t chunk_size = ChunkSize;  //!< objects per chunk
+
+	slab_pool() = default;
+	~slab_pool();
+	slab_pool(slab_pool const &) = delete;
+	slab_pool & operator=(slab_pool const &) = delete;
+
+	template <typename... Args>
+	slab_handle create(Args &&... args);
+
+	void destroy(slab_handle h);
+	T * get(slab_handle h);  //!< \return nullptr for dead handle
+	T const * get(slab_handle h) const;
+	bool alive(slab_handle h) const;
+
+	size_t size() const {return _size;}  //!< number of alive objects
+	size_t capacity() const {return _generations.size();}  //!< number of slots
+
+	//! calls `f(slab_handle, T &)` for all alive objects in slot (memory) order
+	template <typename F>
+	void for_each(F && f);
+
+	template <typename F>
+	void for_each(F && f) const;
+
+private:
+	T * slot(uint32_t index) const {return _chunks[index / chunk_size] + index % chunk_size;}
+	uint32_t allocate_slot();
+
+	std::vector<T *> _chunks;  // raw storage for chunk_size objects
+	std::vector<uint32_t> _generations;  // per slot
+	std::vector<uint8_t> _alive;  // per slot
+	std::vector<uint32_t> _free;  // free slot indices
+	size_t _size = 0;
+};
+
+template <typename T, size_t ChunkSize>
+slab_pool<T, ChunkSize>::~slab_pool()
+{
+	for (uint32_t i = 0; i < _alive.size(); ++i)
+	{
+		if (_alive[i])
+			slot(i)->~T();
+	}
+
+	for (T * chunk : _chunks)
+		::operator delete(chunk, std::align_val_t{alignof(T)});
+}
+
+template <typename T, size_t ChunkSize>
+template <typename... Args>
+slab_handle slab_pool<T, ChunkSize>::create(Args &&... args)
+{
+	uint32_t const idx = allocate_slot();
+	new (slot(idx)) T(std::forward<Args>(args)...);
+	_alive[idx] = 1;
+	++_size;
+	return slab_handle{idx, _generations[idx]};
+}
+
+template <typename T, size_t ChunkSize>
+void slab_pool<T, ChunkSize>::destroy(slab_handle h)
+{
+	assert(alive(h) && "dead handle");
+	slot(h.index)->~T();
+	_alive[h.index] = 0;
+	++_generations[h.index];
+	_free.push_back(h.index);
+	--_size;
+}
+
+template <typename T, size_t ChunkSize>
+T * slab_pool<T, ChunkSize>::get(slab_handle h)
+{
+	return alive(h) ? slot(h.index) : nullptr;
+}
+
+template <typename T, size_t ChunkSize>
+T const * slab_pool<T, ChunkSize>::get(slab_handle h) const
+{
+	return alive(h) ? slot(h.index) : nullptr;
+}
+
+template <typename T, size_t ChunkSize>
+bool slab_pool<T, ChunkSize>::alive(slab_handle h) const
+{
+	return h.index < _generations.size() && _alive[h.index] && _generations[h.index] == h.generation;
+}
+
+template <typename T, size_t ChunkSize>
+template <typename F>
+void slab_pool<T, ChunkSize>::for_each(F && f)
+{
+	uint32_t const count = static_cast<uint32_t>(_generations.size());
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (_alive[i])
+			f(slab_handle{i, _generations[i]}, *slot(i));
+	}
+}
+
+template <typename T, size_t ChunkSize>
+template <typename F>
+void slab_pool<T, ChunkSize>::for_each(F && f) const
+{
+	uint32_t const count = static_cast<uint32_t>(_generations.size());
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (_alive[i])
+			f(slab_handle{i, _generations[i]}, static_cast<T const &>(*slot(i)));
+	}
+}
+
+template <typename T, size_t ChunkSize>
+uint32_t slab_pool<T, ChunkSize>::allocate_slot()
+{
+	if (!_free.empty())
+	{
+		uint32_t const idx = _free.back();
+		_free.pop_back();
+		return idx;
+	}
+
+	uint32_t const idx = static_cast<uint32_t>(_generations.size());
+	if (idx == _chunks.size() * chunk_size)  // all chunks full
+	{
+		void * chunk = ::operator new(sizeof(T) * chunk_size, std::align_val_t{alignof(T)});
+		_chunks.push_back(static_cast<T *>(chunk));
+
+		_generations.reserve(_chunks.size() * chunk_size);
+		_alive.reserve(_chunks.size() * chunk_size);
+		_free.reserve(_chunks.size() * chunk_size);
+	}
+
+	_generations.push_back(0);
+	_alive.push_back(0);
+	return idx;
+}
+
+}  // physics
@@ -0,0 +1,98 @@
+#include <cmath>
+#include <cassert>
+#include "spatial_hash.hpp"
+
+using std::size;
+using std::floor;
+
+namespace physics {
+
+void spatial_hash::reset(btScalar cell_size, size_t item_count)
+{
+	assert(cell_size > 0);
+	_inv_cell_size = 1 / cell_size;
+
+	uint32_t bucket_count = 64;  // power of two
+	while (bucket_count < 2 * item_count)
+		bucket_count *= 2;
+	_bucket_mask = bucket_count - 1;
+
+	_item_buckets.clear();
+}
+
+bool spatial_hash::insert(uint32_t item, btScalar const * min, btScalar const * max, size_t max_cells)
+{
+	cell const lo = cell_of(min),
+		hi = cell_of(max);
+
+	// extents in int64_t, each one checked first so the product can't overflow
+	int64_t const limit = static_cast<int64_t>(max_cells),
+		dx = int64_t{hi.x} - lo.x + 1,
+		dy = int64_t{hi.y} - lo.y + 1,
+		dz = int64_t{hi.z} - lo.z + 1;
+	if (dx > limit || dy > limit || dz > limit || dx * dy * dz > limit)
+		return false;
+
+	size_t const first = size(_item_buckets);
+	for (int32_t z = lo.z; z <= hi.z; ++z)
+	{
+		for (int32_t y = lo.y; y <= hi.y; ++y)
+		{
+			for (int32_t x = lo.x; x <= hi.x; ++x)
+			{
+				// item cells can share bucket, but item goes into the bucket only once
+				uint32_t const bucket = bucket_of(cell{x, y, z});
+				bool found = false;
+				for (size_t i = first; i < size(_item_buckets) && !found; ++i)
+					found = _item_buckets[i].first == bucket;
+
+				if (!found)
+					_item_buckets.emplace_back(bucket, item);
+			}
+		}
+	}
+
+	return true;
+}
+
+//! _bucket_start[b] holds bucket end and is decremented to bucket start
+void spatial_hash::sort()
+{
+	uint32_t const buckets = bucket_count();
+	_bucket_start.assign(buckets + 1, 0);
+	for (auto const & [bucket, item] : _item_buckets)
+		++_bucket_start[bucket];
+
+	for (uint32_t b = 1; b < buckets; ++b)
+		_bucket_start[b] += _bucket_start[b-1];
+	_bucket_start[buckets] = static_cast<uint32_t>(size(_item_buckets));
+
+	_items.resize(size(_item_buckets));
+	for (auto const & [bucket, item] : _item_buckets)
+		_items[--_bucket_start[bucket]] = item;
+}
+
+//! cell coordinate clamped to ±2^30 in float (e.g. ground plane AABB), so conversion to int32_t is defined
+static int32_t cell_coordinate(btScalar x)
+{
+	btScalar const limit = btScalar(1 << 30),
+		c = floor(x);
+	return static_cast<int32_t>(c > limit ? limit : (c > -limit ? c : -limit));  // NaN goes to -limit
+}
+
+spatial_hash::cell spatial_hash::cell_of(btScalar const * p) const
+{
+	return cell{cell_coordinate(p[0] * _inv_cell_size),
+		cell_coordinate(p[1] * _inv_cell_size),
+		cell_coordinate(p[2] * _inv_cell_size)};
+}
+
+uint32_t spatial_hash::bucket_of(cell const & c) const
+{
+	uint32_t const h = (static_cast<uint32_t>(c.x) * 73856093u)
+		^ (static_cast<uint32_t>(c.y) * 19349663u)
+		^ (static_cast<uint32_t>(c.z) * 83492791u);
+	return h & _bucket_mask;
+}
+
+}  // physics
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <bullet/LinearMath/btScalar.h>
+
+namespace physics {
+
+/*! Uniform grid spatial hash shared by grid_broadphase and proximity_grid.
+
+Items (AABB boxes) are hashed into buckets of the cells they touch and buckets are laid out contiguously
+by counting sort, so items sharing a bucket are next to each other in one dense array. Hash is rebuilt
+from scratch (buffers are reused).
+\code
+spatial_hash hash;
+hash.reset(cell_size, box_count);
+for (uint32_t i = 0; i < box_count; ++i)
+	hash.insert(i, boxes[i].min, boxes[i].max, 8);
+hash.sort();
+for (uint32_t b = 0; b < hash.bucket_count(); ++b)
+	for (uint32_t i = hash.bucket_begin(b); i < hash.bucket_end(b); ++i)
+		...  // hash.items()[i] shares bucket b
+\endcode */
+class spatial_hash
+{
+public:
+	struct cell
+	{
+		int32_t x, y, z;
+	};
+
+	//! starts a new hash, about two buckets per item
+	void reset(btScalar cell_size, size_t item_count);
+
+	/*! adds `item` into buckets of all cells touched by [min, max] box (once per bucket)
+	\return false for box touching more than `max_cells` cells, item is not added then */
+	bool insert(uint32_t item, btScalar const * min, btScalar const * max, size_t max_cells);
+	void sort();  //!< counting sort by bucket, call once after all insert() calls
+
+	cell cell_of(btScalar const * p) const;
+	uint32_t bucket_of(cell const & c) const;
+	uint32_t bucket_count() const {return _bucket_mask + 1;}
+	uint32_t bucket_begin(uint32_t bucket) const {return _bucket_start[bucket];}  //!< first index into items()
+	uint32_t bucket_end(uint32_t bucket) const {return _bucket_start[bucket + 1];}
+	std::vector<uint32_t> const & items() const {return _items;}  //!< items sorted by bucket
+
+private:
+	btScalar _inv_cell_size = 1;
+	uint32_t _bucket_mask = 0;
+	std::vector<std::pair<uint32_t, uint32_t>> _item_buckets;  // (bucket, item) before counting sort
+	std::vector<uint32_t> _bucket_start;  // bucket items range in _items (prefix sums)
+	std::vector<uint32_t> _items;
+};
+
+}  // physics
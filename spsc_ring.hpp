@@ -0,0 +1,123 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+namespace physics {
+
+/*! Lock-free single-producer/single-consumer ring buffer.
+
+Producer (e.g. physics simulation) and consumer (e.g. audio thread) never block each other. When the
+ring is full, producer pushes fail (nothing is overwritten).
+\code
+spsc_ring<int> q{1024};
+q.push(1);  // producer thread
+int v;
+while (q.pop(v)) {...}  // consumer thread
+\endcode */
+template <typename T>
+class spsc_ring
+{
+public:
+	explicit spsc_ring(size_t capacity);  //!< capacity is rounded up to power of two
+
+	// producer
+	bool push(T const & v);
+	size_t push(T const * first, size_t n);  //!< \return number of pushed elements
+
+	// consumer
+	bool pop(T & v);
+
+	//! pops all available elements, calls `f(T const &)` for each of them \return number of elements
+	template <typename F>
+	size_t drain(F && f);
+
+	size_t capacity() const {return _mask + 1;}
+
+private:
+	static constexpr size_t cache_line = 64;
+
+	std::vector<T> _buf;
+	size_t const _mask;
+
+	alignas(cache_line) std::atomic<size_t> _head;  //!< next element to read, written by consumer
+	alignas(cache_line) std::atomic<size_t> _tail;  //!< next element to write, written by producer
+	alignas(cache_line) size_t _producer_head_cache;  //!< producer's copy of _head
+	alignas(cache_line) size_t _consumer_tail_cache;  //!< consumer's copy of _tail
+};
+
+inline size_t next_power_of_two(size_t n)
+{
+	size_t result = 1;
+	while (result < n)
+		result <<= 1;
+	return result;
+}
+
+template <typename T>
+spsc_ring<T>::spsc_ring(size_t capacity)
+	: _buf(next_power_of_two(capacity))
+	, _mask{_buf.size() - 1}
+	, _head{0}
+	, _tail{0}
+	, _producer_head_cache{0}
+	, _consumer_tail_cache{0}
+{}
+
+template <typename T>
+bool spsc_ring<T>::push(T const & v)
+{
+	return push(&v, 1) == 1;
+}
+
+template <typename T>
+size_t spsc_ring<T>::push(T const * first, size_t n)
+{
+	size_t const tail = _tail.load(std::memory_order_relaxed);
+
+	size_t free_count = capacity() - (tail - _producer_head_cache);
+	if (free_count < n)  // refresh consumer position only if needed
+	{
+		_producer_head_cache = _head.load(std::memory_order_acquire);
+		free_count = capacity() - (tail - _producer_head_cache);
+	}
+
+	size_t const count = n < free_count ? n : free_count;
+	for (size_t i = 0; i < count; ++i)
+		_buf[(tail + i) & _mask] = first[i];
+
+	_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+template <typename T>
+bool spsc_ring<T>::pop(T & v)
+{
+	size_t const head = _head.load(std::memory_order_relaxed);
+	if (head == _consumer_tail_cache)
+	{
+		_consumer_tail_cache = _tail.load(std::memory_order_acquire);
+		if (head == _consumer_tail_cache)
+			return false;  // empty
+	}
+
+	v = _buf[head & _mask];
+	_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+template <typename F>
+size_t spsc_ring<T>::drain(F && f)
+{
+	size_t const head = _head.load(std::memory_order_relaxed);
+	_consumer_tail_cache = _tail.load(std::memory_order_acquire);
+
+	for (size_t i = head; i != _consumer_tail_cache; ++i)
+		f(_buf[i & _mask]);
+
+	_head.store(_consumer_tail_cache, std::memory_order_release);
+	return _consumer_tail_cache - head;
+}
+
+}  // physics
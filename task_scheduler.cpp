@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cassert>
+#include "task_scheduler.hpp"
+
+using std::min, std::max;
+using std::thread;
+using std::mutex, std::unique_lock, std::lock_guard;
+
+namespace physics {
+
+task_scheduler::task_scheduler(int thread_count)
+	: btITaskScheduler{"physics::task_scheduler"}
+	, _busy{false}
+{
+	if (thread_count <= 0)
+		thread_count = max(1u, thread::hardware_concurrency());
+
+	_thread_count = thread_count;
+
+	_workers.reserve(thread_count - 1);  // caller thread also runs jobs
+	for (int i = 0; i < thread_count - 1; ++i)
+		_workers.emplace_back([this, i]{worker_loop(i);});
+}
+
+task_scheduler::~task_scheduler()
+{
+	{
+		lock_guard<mutex> lock{_mutex};
+		_quit = true;
+	}
+	_wake.notify_all();
+
+	for (thread & t : _workers)
+		t.join();
+}
+
+/*! Bullet sizes per thread arrays by this value, but indexes them by btGetCurrentThreadIndex() which is
+global for all threads (e.g. world::step_async() thread or other pools), so pool size is not enough. */
+int task_scheduler::getMaxNumThreads() const
+{
+	return BT_MAX_THREAD_COUNT;
+}
+
+int task_scheduler::getNumThreads() const
+{
+	return _thread_count;
+}
+
+void task_scheduler::setNumThreads(int thread_count)
+{
+	_thread_count = max(1, min(thread_count, static_cast<int>(size(_workers)) + 1));
+}
+
+void task_scheduler::parallelFor(int first, int last, int grain, btIParallelForBody const & body)
+{
+	parallel_for(first, last, grain, [&body](int first, int last) {
+		body.forLoop(first, last);
+	});
+}
+
+btScalar task_scheduler::parallelSum(int first, int last, int grain, btIParallelSumBody const & body)
+{
+	mutex sum_mutex;
+	btScalar sum = 0;
+	parallel_for(first, last, grain, [&](int first, int last) {
+		btScalar const partial = body.sumLoop(first, last);
+		lock_guard<mutex> lock{sum_mutex};
+		sum += partial;
+	});
+	return sum;
+}
+
+bool task_scheduler::dispatch(int first, int last, int grain, void (* run)(void const *, int, int),
+	void const * context)
+{
+	grain = max(grain, 1);
+	if (last - first <= grain || _thread_count < 2 || _busy.exchange(true))
+		return false;  // run serially
+
+	job j;
+	j.run = run;
+	j.context = context;
+	j.last = last;
+	j.grain = grain;
+	j.next = first;
+
+	{
+		lock_guard<mutex> lock{_mutex};
+		_job = &j;
+		_job_workers = _thread_count - 1;
+		_pending = _job_workers;
+		++_job_id;
+	}
+	_wake.notify_all();
+
+	execute(j);  // caller thread helps
+
+	{
+		unique_lock<mutex> lock{_mutex};
+		_done.wait(lock, [this]{return _pending == 0;});
+		_job = nullptr;
+	}
+
+	_busy = false;
+	return true;
+}
+
+void task_scheduler::execute(job & j)
+{
+	while (true)
+	{
+		int const first = j.next.fetch_add(j.grain);
+		if (first >= j.last)
+			break;
+		j.run(j.context, first, min(first + j.grain, j.last));
+	}
+}
+
+void task_scheduler::worker_loop(int worker_idx)
+{
+	uint64_t last_job_id = 0;
+	while (true)
+	{
+		job * j = nullptr;
+		{
+			unique_lock<mutex> lock{_mutex};
+			_wake.wait(lock, [&]{
+				return _quit || (_job && _job_id != last_job_id && worker_idx < _job_workers);
+			});
+
+			if (_quit)
+				return;
+
+			last_job_id = _job_id;
+			j = _job;
+		}
+
+		execute(*j);
+
+		{
+			lock_guard<mutex> lock{_mutex};
+			assert(_pending > 0);
+			if (--_pending == 0)
+				_done.notify_one();
+		}
+	}
+}
+
+}  // physics
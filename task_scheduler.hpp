@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <bullet/LinearMath/btThreads.h>
+
+namespace physics {
+
+/*! Thread pool based task scheduler for Bullet's multithreaded world.
+
+Can be also used directly to run own loops in parallel
+\code
+task_scheduler pool{4};
+pool.parallel_for(0, n, 256, [&](int first, int last){
+	for (int i = first; i < last; ++i)
+		work(i);
+});
+\endcode
+\note nested parallel loops run serially in the calling thread */
+class task_scheduler : public btITaskScheduler
+{
+public:
+	explicit task_scheduler(int thread_count = 0);  //!< 0 for all hardware threads
+	~task_scheduler() override;
+
+	/*! calls `f(first, last)` for chunks of [first, last) range (chunk has at most `grain` elements)
+	from pool threads and blocks till all chunks are done */
+	template <typename F>
+	void parallel_for(int first, int last, int grain, F const & f);
+
+	// btITaskScheduler
+	int getMaxNumThreads() const override;
+	int getNumThreads() const override;
+	void setNumThreads(int thread_count) override;
+	void parallelFor(int first, int last, int grain, btIParallelForBody const & body) override;
+	btScalar parallelSum(int first, int last, int grain, btIParallelSumBody const & body) override;
+
+private:
+	struct job
+	{
+		void (* run)(void const * context, int first, int last);
+		void const * context;
+		int last;
+		int grain;
+		std::atomic<int> next;
+	};
+
+	bool dispatch(int first, int last, int grain, void (* run)(void const *, int, int), void const * context);
+	void execute(job & j);
+	void worker_loop(int worker_idx);
+
+	std::vector<std::thread> _workers;
+	std::atomic<int> _thread_count;  //!< active threads including caller
+	std::atomic<bool> _busy;  //!< set while job is running (nested loops detection)
+
+	std::mutex _mutex;
+	std::condition_variable _wake, _done;
+	job * _job = nullptr;
+	uint64_t _job_id = 0;
+	int _job_workers = 0;  //!< number of workers taking part in current job
+	int _pending = 0;  //!< number of workers still running current job
+	bool _quit = false;
+};
+
+template <typename F>
+void task_scheduler::parallel_for(int first, int last, int grain, F const & f)
+{
+	auto run = [](void const * context, int first, int last) {
+		(*static_cast<F const *>(context))(first, last);
+	};
+
+	if (!dispatch(first, last, grain, run, &f))
+		f(first, last);
+}
+
+}  // physics
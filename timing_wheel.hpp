@@ -0,0 +1,134 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+/*! Timing wheel expiry queue for dense ids (e.g. cube indices).
+
+Ids are kept in intrusive per-slot lists (links are stored per id), so schedule, refresh and cancel
+are O(1) and expire() visits only slots elapsed since the last call. Memory is allocated only when a
+new (bigger) id is scheduled.
+\code
+timing_wheel highlights{32, 1.0/64.0};  // 0.5s span
+highlights.schedule(cube_id, now + 0.25);
+highlights.expire(now, [](uint32_t id){...});
+\endcode */
+class timing_wheel
+{
+public:
+	//! \param resolution slot time span in s, expiry times are rounded up to it
+	timing_wheel(size_t slot_count, double resolution);
+
+	void schedule(uint32_t id, double t_expire);  //!< inserts or refreshes (reschedules) id
+	void cancel(uint32_t id);
+	bool scheduled(uint32_t id) const {return id < _slot.size() && _slot[id] != none;}
+	size_t size() const {return _size;}  //!< number of scheduled ids
+
+	//! removes all ids expired till `now` and calls `f(uint32_t id)` for each of them
+	template <typename F>
+	void expire(double now, F && f);
+
+private:
+	static constexpr uint32_t none = ~0u;
+
+	int64_t tick(double t) const {return static_cast<int64_t>(std::ceil(t / _resolution));}
+	void unlink(uint32_t id);
+
+	double const _resolution;
+	int64_t _current_tick = 0;  // all ticks up to this one were expired
+	std::vector<uint32_t> _heads;  // per slot list head
+	std::vector<uint32_t> _next, _prev, _slot;  // per id links
+	std::vector<int64_t> _ticks;  // per id expiry tick
+	size_t _size = 0;
+};
+
+inline timing_wheel::timing_wheel(size_t slot_count, double resolution)
+	: _resolution{resolution}
+	, _heads(slot_count, none)
+{
+	assert(slot_count > 0 && resolution > 0);
+}
+
+inline void timing_wheel::schedule(uint32_t id, double t_expire)
+{
+	if (id >= _slot.size())
+	{
+		size_t const n = id + 1;
+		_next.resize(n, none);
+		_prev.resize(n, none);
+		_slot.resize(n, none);
+		_ticks.resize(n, 0);
+	}
+
+	if (scheduled(id))
+		unlink(id);
+	else
+		++_size;
+
+	// already expired ids go to the next tick
+	int64_t const t = std::max(tick(t_expire), _current_tick + 1);
+	uint32_t const slot = static_cast<uint32_t>(t % static_cast<int64_t>(_heads.size()));
+
+	_ticks[id] = t;
+	_slot[id] = slot;
+	_prev[id] = none;
+	_next[id] = _heads[slot];
+	if (_heads[slot] != none)
+		_prev[_heads[slot]] = id;
+	_heads[slot] = id;
+}
+
+inline void timing_wheel::cancel(uint32_t id)
+{
+	if (!scheduled(id))
+		return;
+
+	unlink(id);
+	_slot[id] = none;
+	--_size;
+}
+
+template <typename F>
+void timing_wheel::expire(double now, F && f)
+{
+	int64_t const now_tick = static_cast<int64_t>(std::floor(now / _resolution));
+	if (now_tick <= _current_tick)
+		return;
+
+	// each slot needs to be visited at most once
+	int64_t const slot_count = static_cast<int64_t>(_heads.size());
+	int64_t const first_tick = std::max(_current_tick + 1, now_tick - slot_count + 1);
+
+	for (int64_t t = first_tick; t <= now_tick; ++t)
+	{
+		uint32_t id = _heads[t % slot_count];
+		while (id != none)
+		{
+			uint32_t const next = _next[id];
+			if (_ticks[id] <= now_tick)  // ids scheduled more than one wheel turn ahead stay
+			{
+				unlink(id);
+				_slot[id] = none;
+				--_size;
+				f(id);
+			}
+			id = next;
+		}
+	}
+
+	_current_tick = now_tick;
+}
+
+inline void timing_wheel::unlink(uint32_t id)
+{
+	if (_prev[id] != none)
+		_next[_prev[id]] = _next[id];
+	else
+		_heads[_slot[id]] = _next[id];
+
+	if (_next[id] != none)
+		_prev[_next[id]] = _prev[id];
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.hpp"
+
+using std::string;
+using std::ios;
+using std::size;
+using std::memcpy, std::memcmp;
+using std::lround, std::sqrt, std::fabs;
+using std::clamp, std::max;
+
+namespace physics {
+
+static constexpr char magic[4] = {'P', 'H', 'T', 'R'};
+static constexpr size_t header_size = sizeof(magic) + sizeof(uint32_t) + sizeof(float);
+static constexpr size_t body_size = sizeof(uint32_t) + 3*sizeof(int16_t) + sizeof(uint32_t);
+static constexpr size_t event_size = sizeof(uint8_t) + 2*sizeof(uint32_t);
+static constexpr float sqrt2 = 1.41421356f;
+
+//! smallest three quaternion encoding (2 bits index of the largest component, 3 x 10 bits the others)
+static uint32_t encode_orientation(btQuaternion const & q)
+{
+	float const v[4] = {float(q.x()), float(q.y()), float(q.z()), float(q.w())};
+
+	int largest = 0;
+	for (int i = 1; i < 4; ++i)
+	{
+		if (fabs(v[i]) > fabs(v[largest]))
+			largest = i;
+	}
+
+	float const sign = v[largest] < 0 ? -1.f : 1.f;  // q and -q are the same rotation
+
+	uint32_t result = static_cast<uint32_t>(largest) << 30;
+	int shift = 20;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+
+		float const x = clamp(sign * v[i] * sqrt2, -1.f, 1.f);  // [-1/sqrt2, 1/sqrt2] -> [-1, 1]
+		uint32_t const bits = static_cast<uint32_t>(lround((x + 1.f) * 0.5f * 1023.f));
+		result |= bits << shift;
+		shift -= 10;
+	}
+
+	return result;
+}
+
+static void decode_orientation(uint32_t bits, float * q)
+{
+	int const largest = static_cast<int>(bits >> 30);
+	int shift = 20;
+	float sum = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i == largest)
+			continue;
+
+		float const x = (((bits >> shift) & 1023u) / 1023.f * 2.f - 1.f) / sqrt2;
+		q[i] = x;
+		sum += x*x;
+		shift -= 10;
+	}
+	q[largest] = sqrt(max(0.f, 1.f - sum));
+}
+
+static int16_t quantize_position(btScalar x, float range)
+{
+	return static_cast<int16_t>(lround(clamp(float(x) / range, -1.f, 1.f) * 32767.f));
+}
+
+template <typename T>
+static T load(uint8_t const * p)
+{
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+
+trace_recorder::trace_recorder(string const & path, float position_range)
+	: _out{path, ios::binary | ios::trunc}
+	, _position_range{position_range}
+{
+	_out.write(magic, sizeof(magic));
+	_out.write(reinterpret_cast<char const *>(&version), sizeof(version));
+	_out.write(reinterpret_cast<char const *>(&_position_range), sizeof(_position_range));
+	_out.flush();
+}
+
+void trace_recorder::write_frame(world const & w)
+{
+	_buf.clear();
+
+	// counts are patched after bodies are written
+	put(uint32_t{0});
+	put(uint32_t{0});
+	put(uint32_t{0});
+
+	uint32_t body_count = 0;
+	w.for_each_body([this, &w, &body_count](body_handle h, body const & b){
+		if (!b.rigid_body().isInWorld() && !w.is_particle(h))
+			return;  // not simulated (e.g. pooled bodies)
+
+		btTransform const T = w.interpolated_transform(h);
+		btVector3 const & p = T.getOrigin();
+
+		put(static_cast<uint32_t>(b.rigid_body().getUserIndex()));
+		put(quantize_position(p.x(), _position_range));
+		put(quantize_position(p.y(), _position_range));
+		put(quantize_position(p.z(), _position_range));
+		put(encode_orientation(T.getRotation()));
+		++body_count;
+	});
+
+	uint32_t event_count = 0;
+	for (contact_event const & e : w.contact_events())
+	{
+		put(static_cast<uint8_t>(e.type));
+		put(static_cast<uint32_t>(e.a->getUserIndex()));
+		put(static_cast<uint32_t>(e.b->getUserIndex()));
+		++event_count;
+	}
+
+	uint32_t const frame_size = static_cast<uint32_t>(_buf.size() - sizeof(uint32_t));
+	memcpy(&_buf[0], &frame_size, sizeof(uint32_t));
+	memcpy(&_buf[4], &body_count, sizeof(uint32_t));
+	memcpy(&_buf[8], &event_count, sizeof(uint32_t));
+
+	// one append per frame, flushed so a crashed run keeps all complete frames
+	_out.write(reinterpret_cast<char const *>(_buf.data()), _buf.size());
+	_out.flush();
+	++_frames;
+}
+
+template <typename T>
+void trace_recorder::put(T const & v)
+{
+	size_t const pos = _buf.size();
+	_buf.resize(pos + sizeof(T));
+	memcpy(&_buf[pos], &v, sizeof(T));
+}
+
+
+trace_player::trace_player(string const & path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= header_size)
+	{
+		void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			_data = static_cast<uint8_t const *>(p);
+			_size = st.st_size;
+		}
+	}
+	close(fd);  // mapping stays valid
+
+	if (!_data)
+		return;
+
+	if (memcmp(_data, magic, sizeof(magic)) != 0 || load<uint32_t>(_data + 4) != trace_recorder::version)
+	{
+		munmap(const_cast<uint8_t *>(_data), _size);
+		_data = nullptr;
+		return;
+	}
+
+	_position_range = load<float>(_data + 8);
+
+	// frame index
+	size_t offset = header_size;
+	while (offset + sizeof(uint32_t) <= _size)
+	{
+		size_t const frame_size = load<uint32_t>(_data + offset);
+		if (offset + sizeof(uint32_t) + frame_size > _size)
+			break;  // truncated frame
+
+		// counts needs to match frame size, read_frame() trusts them
+		if (frame_size < 2*sizeof(uint32_t))
+			break;
+		uint64_t const body_count = load<uint32_t>(_data + offset + 4),
+			event_count = load<uint32_t>(_data + offset + 8);
+		if (2*sizeof(uint32_t) + body_count*body_size + event_count*event_size != frame_size)
+			break;  // corrupt frame
+
+		_frames.push_back(offset);
+		offset += sizeof(uint32_t) + frame_size;
+	}
+}
+
+trace_player::~trace_player()
+{
+	if (_data)
+		munmap(const_cast<uint8_t *>(_data), _size);
+}
+
+void trace_player::read_frame(size_t idx, trace_frame & frame) const
+{
+	assert(idx < size(_frames));
+	uint8_t const * p = _data + _frames[idx] + sizeof(uint32_t);
+
+	uint32_t const body_count = load<uint32_t>(p);
+	uint32_t const event_count = load<uint32_t>(p + 4);
+	p += 8;
+
+	frame.ids.resize(body_count);
+	frame.positions.resize(3*body_count);
+	frame.orientations.resize(4*body_count);
+
+	float const scale = _position_range / 32767.f;
+	for (uint32_t i = 0; i < body_count; ++i, p += body_size)
+	{
+		frame.ids[i] = load<uint32_t>(p);
+
+		float * pos = &frame.positions[3*i];
+		pos[0] = load<int16_t>(p + 4) * scale;
+		pos[1] = load<int16_t>(p + 6) * scale;
+		pos[2] = load<int16_t>(p + 8) * scale;
+
+		decode_orientation(load<uint32_t>(p + 10), &frame.orientations[4*i]);
+	}
+
+	frame.events.resize(event_count);
+	for (uint32_t i = 0; i < event_count; ++i, p += event_size)
+	{
+		frame.events[i] = trace_frame::event{static_cast<contact_event::event_type>(load<uint8_t>(p)),
+			load<uint32_t>(p + 1), load<uint32_t>(p + 5)};
+	}
+}
+
+}  // physics
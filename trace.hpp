@@ -0,0 +1,92 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include "physics.hpp"
+
+namespace physics {
+
+/* trace file layout (little endian)
+
+header: magic "PHTR", uint32 version, float position range
+frame: uint32 frame size (bytes after this field), uint32 body count, uint32 event count,
+	body count x {uint32 id, int16 position[3], uint32 orientation (smallest three)},
+	event count x {uint8 type, uint32 id a, uint32 id b}
+
+Body id is btCollisionObject user index (see btCollisionObject::setUserIndex()), only simulated bodies
+(particles included) are recorded. */
+
+//! decoded trace frame, body transforms in record order
+struct trace_frame
+{
+	struct event
+	{
+		contact_event::event_type type;
+		uint32_t a, b;  //!< body ids
+	};
+
+	std::vector<uint32_t> ids;  //!< body ids
+	std::vector<float> positions;  //!< body positions (x, y, z)
+	std::vector<float> orientations;  //!< body orientations (x, y, z, w)
+	std::vector<event> events;
+
+	size_t body_count() const {return ids.size();}
+};
+
+/*! Appends world frames (interpolated body transforms and contact events) into compact binary trace
+file. Positions are quantized to 16 bits per axis within `position_range` (positions outside are
+clamped), orientations are stored as 32 bit smallest three quaternions, so one body takes 14 bytes.
+\code
+trace_recorder rec{"run.trace"};
+w.record(&rec);  // world writes a frame after each simulate(), simulate_fixed() call
+\endcode */
+class trace_recorder
+{
+public:
+	static constexpr uint32_t version = 1;
+
+	explicit trace_recorder(std::string const & path, float position_range = 128);
+	bool good() const {return _out.good();}
+	size_t frame_count() const {return _frames;}
+
+	void write_frame(world const & w);  //!< called by world
+
+private:
+	template <typename T>
+	void put(T const & v);
+
+	std::ofstream _out;
+	float const _position_range;
+	std::vector<uint8_t> _buf;  // frame, reused
+	size_t _frames = 0;
+};
+
+/*! Plays trace file written by trace_recorder, file is memory mapped and frames are decoded on demand.
+\code
+trace_player player{"run.trace"};
+trace_frame frame;
+for (size_t i = 0; i < player.frame_count(); ++i)
+	player.read_frame(i, frame);
+\endcode */
+class trace_player
+{
+public:
+	explicit trace_player(std::string const & path);
+	~trace_player();
+	trace_player(trace_player const &) = delete;
+	trace_player & operator=(trace_player const &) = delete;
+
+	bool good() const {return _data != nullptr;}  //!< file mapped and header valid
+	size_t frame_count() const {return _frames.size();}  //!< valid frames (frames from the first truncated or corrupt one are ignored)
+	void read_frame(size_t idx, trace_frame & frame) const;
+
+private:
+	uint8_t const * _data = nullptr;
+	size_t _size = 0;
+	float _position_range = 0;
+	std::vector<size_t> _frames;  // frame offsets (frame size field)
+};
+
+}  // physics
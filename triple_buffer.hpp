@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace physics {
+
+/*! Lock-free triple buffer for one producer and one consumer thread.
+
+Producer writes into back() buffer and publishes it, consumer always reads the latest published
+buffer and neither side ever waits for the other.
+\code
+triple_buffer<state> buf;
+// producer thread
+fill(buf.back());
+buf.publish();
+// consumer thread
+buf.update();
+use(buf.front());
+\endcode */
+template <typename T>
+class triple_buffer
+{
+public:
+	// producer
+	T & back() {return _buffers[_back];}
+	void publish();  //!< makes back() buffer available to consumer
+
+	// consumer
+	bool update();  //!< switches front() to the latest published buffer \return true if there was a new one
+	T const & front() const {return _buffers[_front];}
+
+private:
+	static constexpr uint8_t index_mask = 3;
+	static constexpr uint8_t fresh_bit = 4;  //!< middle buffer was published and not yet consumed
+
+	T _buffers[3];
+	uint8_t _back = 0;  //!< producer owned
+	uint8_t _front = 1;  //!< consumer owned
+	std::atomic<uint8_t> _middle{2};
+};
+
+template <typename T>
+void triple_buffer<T>::publish()
+{
+	_back = _middle.exchange(_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+}
+
+template <typename T>
+bool triple_buffer<T>::update()
+{
+	if (!(_middle.load(std::memory_order_relaxed) & fresh_bit))
+		return false;
+
+	_front = _middle.exchange(_front, std::memory_order_acq_rel) & index_mask;
+	return true;
+}
+
+}  // physics